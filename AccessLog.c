@@ -0,0 +1,265 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "AccessLog.h"
+#include "Metrics.h"
+#include "Server.h"
+#include "Ticker.h"
+
+#define ACCESS_LOG_BATCH_SIZE (64 * 1024)
+// one formatted record never needs more than this
+#define ACCESS_LOG_MAX_LINE 1024
+// how long the writer naps when every ring is empty
+#define ACCESS_LOG_IDLE_NS 10000000
+
+// Single producer (the owning thread), single consumer (the writer).
+// head and tail only ever grow; each sits on its own cache line so the two
+// sides don't keep stealing it from each other.
+typedef struct Access_ring {
+  _Alignas(CACHE_LINE_SIZE) unsigned long tail; // producer's
+  unsigned long cached_head; // producer's last look at head
+  long dropped;
+
+  _Alignas(CACHE_LINE_SIZE) unsigned long head; // consumer's
+
+  _Alignas(CACHE_LINE_SIZE) Access_record records[ACCESS_LOG_RING_SIZE];
+  struct Access_ring *next;
+} Access_ring;
+
+int access_log_fd = -1;
+// the writer's side of the rings; access_log_flush() may drain them too
+pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+__thread Access_ring *thread_ring = NULL;
+// every thread's ring; only ever pushed onto
+Access_ring *all_rings = NULL;
+
+void *access_log_threadfunc(void *);
+
+int access_log_init(const char *path) {
+  if (!path)
+    return SUCCESS;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    perror(path);
+    return FAIL;
+  }
+
+  // the writer reads it as it starts
+  access_log_fd = fd;
+
+  pthread_t writer;
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  int result = pthread_create(&writer, &attributes, access_log_threadfunc, NULL);
+  pthread_attr_destroy(&attributes);
+
+  if (result != 0) {
+    errno = result;
+    perror("pthread_create access log writer");
+    access_log_fd = -1;
+    close(fd);
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+int access_log_enabled(void) {
+  return __atomic_load_n(&access_log_fd, __ATOMIC_RELAXED) != -1;
+}
+
+Access_ring *register_ring(void) {
+  Access_ring *ring = aligned_alloc(CACHE_LINE_SIZE, sizeof(Access_ring));
+  if (!ring) {
+    perror("access log ring");
+    exit(1);
+  }
+  memset(ring, 0, sizeof(Access_ring));
+
+  ring->next = __atomic_load_n(&all_rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&all_rings, &ring->next, ring, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+
+  thread_ring = ring;
+  return ring;
+}
+
+// copies the token at *text up to the next space (or line end)
+const char *copy_token(const char *text, char *out, int out_size) {
+  int length = 0;
+  while (*text && *text != ' ' && *text != '\r' && *text != '\n') {
+    if (length < out_size - 1)
+      out[length++] = *text;
+    text++;
+  }
+  out[length] = '\0';
+  return *text == ' ' ? text + 1 : text;
+}
+
+void access_log_record(const char *request, int status, long bytes,
+                       long duration_ns, int client_id) {
+  if (!access_log_enabled())
+    return;
+
+  Access_ring *ring = thread_ring;
+  if (!ring)
+    ring = register_ring();
+
+  unsigned long tail = ring->tail;
+  if (tail - ring->cached_head >= ACCESS_LOG_RING_SIZE) {
+    ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail - ring->cached_head >= ACCESS_LOG_RING_SIZE) {
+      // the writer is behind; losing a line beats stalling a request
+      __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+
+  Access_record *record = &ring->records[tail & (ACCESS_LOG_RING_SIZE - 1)];
+  // the ticker's clock: good to TICKER_PERIOD_NS, and no syscall
+  record->time = ticker_realtime_ns() / 1e9;
+  record->duration_ns = duration_ns;
+  record->bytes = bytes;
+  record->status = status;
+  record->client_id = client_id;
+  const char *rest = copy_token(request, record->method, ACCESS_LOG_MAX_METHOD);
+  copy_token(rest, record->path, ACCESS_LOG_MAX_PATH);
+
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+long access_log_dropped(void) {
+  long total = 0;
+  for (Access_ring *ring = __atomic_load_n(&all_rings, __ATOMIC_ACQUIRE); ring;
+       ring = ring->next)
+    total += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  return total;
+}
+
+// JSON string body: quotes, backslashes and control bytes escaped
+int escape_json(const char *text, char *out) {
+  static const char hex[] = "0123456789abcdef";
+  int length = 0;
+  for (; *text; text++) {
+    unsigned char c = *text;
+    if (c == '"' || c == '\\') {
+      out[length++] = '\\';
+      out[length++] = c;
+    } else if (c < 0x20 || c == 0x7f) {
+      memcpy(out + length, "\\u00", 4);
+      out[length + 4] = hex[c >> 4];
+      out[length + 5] = hex[c & 15];
+      length += 6;
+    } else {
+      out[length++] = c;
+    }
+  }
+  out[length] = '\0';
+  return length;
+}
+
+int format_record(Access_record *record, char *line) {
+  char method[ACCESS_LOG_MAX_METHOD * 6];
+  char path[ACCESS_LOG_MAX_PATH * 6];
+  escape_json(record->method, method);
+  escape_json(record->path, path);
+
+  return snprintf(line, ACCESS_LOG_MAX_LINE,
+                  "{\"time\":%.3f,\"method\":\"%s\",\"path\":\"%s\","
+                  "\"status\":%d,\"bytes\":%ld,\"duration_us\":%.1f,"
+                  "\"client\":%d}\n",
+                  record->time, method, path, record->status, record->bytes,
+                  record->duration_ns / 1000.0, record->client_id);
+}
+
+int write_batch(int fd, const char *batch, int length) {
+  while (length > 0) {
+    ssize_t result = write(fd, batch, length);
+    if (result == -1 && errno == EINTR)
+      continue;
+    if (result == -1) {
+      perror("access log write");
+      return FAIL;
+    }
+    batch += result;
+    length -= result;
+  }
+  return SUCCESS;
+}
+
+// Drains every ring into batch, writing whenever it fills.
+// Returns how many records it found.
+long drain_rings(int fd, char *batch, int *batch_length) {
+  long drained = 0;
+
+  for (Access_ring *ring = __atomic_load_n(&all_rings, __ATOMIC_ACQUIRE); ring;
+       ring = ring->next) {
+    unsigned long head = ring->head;
+    unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+      if (*batch_length > ACCESS_LOG_BATCH_SIZE - ACCESS_LOG_MAX_LINE) {
+        write_batch(fd, batch, *batch_length);
+        *batch_length = 0;
+      }
+      *batch_length += format_record(
+          &ring->records[head & (ACCESS_LOG_RING_SIZE - 1)],
+          batch + *batch_length);
+      drained++;
+    }
+
+    // the slots are the producer's again
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+  }
+
+  return drained;
+}
+
+void *access_log_threadfunc(void *unused) {
+  char *batch = malloc(ACCESS_LOG_BATCH_SIZE);
+  int batch_length = 0;
+  int fd = access_log_fd;
+
+  while (1) {
+    pthread_mutex_lock(&drain_lock);
+    long drained = drain_rings(fd, batch, &batch_length);
+
+    if (batch_length > 0) {
+      write_batch(fd, batch, batch_length);
+      batch_length = 0;
+    }
+    pthread_mutex_unlock(&drain_lock);
+
+    if (drained == 0) {
+      struct timespec nap = {.tv_sec = 0, .tv_nsec = ACCESS_LOG_IDLE_NS};
+      nanosleep(&nap, NULL);
+    }
+  }
+}
+
+void access_log_flush(void) {
+  if (!access_log_enabled())
+    return;
+
+  char *batch = malloc(ACCESS_LOG_BATCH_SIZE);
+  int batch_length = 0;
+  if (!batch)
+    return;
+
+  pthread_mutex_lock(&drain_lock);
+  drain_rings(access_log_fd, batch, &batch_length);
+  if (batch_length > 0)
+    write_batch(access_log_fd, batch, batch_length);
+  pthread_mutex_unlock(&drain_lock);
+
+  free(batch);
+}
@@ -0,0 +1,40 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+// Structured access log: one JSON object per request, appended to a file.
+// Serving threads only copy a small record into their own ring buffer -
+// no lock, no syscall. A background thread drains every ring and writes
+// the lines out in batches. If it falls behind and a ring fills up, new
+// records are dropped and counted rather than making a request wait.
+
+// records each thread's ring holds (power of two)
+#define ACCESS_LOG_RING_SIZE 1024
+// longer paths are cut short in the log
+#define ACCESS_LOG_MAX_PATH 80
+#define ACCESS_LOG_MAX_METHOD 8
+
+typedef struct {
+  double time; // wall clock, seconds since the epoch
+  long duration_ns;
+  long bytes; // response bytes
+  int status;
+  int client_id;
+  char method[ACCESS_LOG_MAX_METHOD];
+  char path[ACCESS_LOG_MAX_PATH];
+} Access_record;
+
+// Opens (appending) path and starts the writer. NULL leaves logging off.
+int access_log_init(const char *path);
+int access_log_enabled(void);
+
+// Logs a request; request is its text, from the request line on.
+void access_log_record(const char *request, int status, long bytes,
+                       long duration_ns, int client_id);
+
+// records dropped so far because a ring was full
+long access_log_dropped(void);
+
+// writes out everything recorded so far; for shutting down
+void access_log_flush(void);
+
+#endif
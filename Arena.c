@@ -0,0 +1,83 @@
+#include <stdlib.h>
+
+#include "Arena.h"
+
+#define CHUNK_HEADER_SIZE ARENA_CHUNK_HEADER_SIZE
+#define CHUNK_CAPACITY ARENA_CHUNK_CAPACITY
+
+void arena_init(Arena *arena) {
+  arena->first = NULL;
+  arena->spilled = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+}
+
+Arena_chunk *new_chunk(int size) {
+  Arena_chunk *chunk = (Arena_chunk *)(size == POOL_BUFFER_SIZE
+                                           ? buffer_pool_get()
+                                           : malloc(size));
+  if (chunk)
+    chunk->size = size;
+  return chunk;
+}
+
+void *arena_alloc(Arena *arena, int size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  if (size == 0)
+    size = ARENA_ALIGNMENT; // still a pointer of its own
+
+  if (arena->end - arena->next >= size) {
+    void *memory = arena->next;
+    arena->next += size;
+    return memory;
+  }
+
+  if (size > CHUNK_CAPACITY) {
+    // a block of its own; the current chunk stays current
+    Arena_chunk *chunk = new_chunk(CHUNK_HEADER_SIZE + size);
+    if (!chunk)
+      return NULL;
+    chunk->next = arena->spilled;
+    arena->spilled = chunk;
+    return (char *)chunk + CHUNK_HEADER_SIZE;
+  }
+
+  Arena_chunk *chunk = new_chunk(POOL_BUFFER_SIZE);
+  if (!chunk)
+    return NULL;
+  if (!arena->first) {
+    chunk->next = NULL;
+    arena->first = chunk;
+  } else {
+    chunk->next = arena->spilled;
+    arena->spilled = chunk;
+  }
+
+  arena->next = (char *)chunk + CHUNK_HEADER_SIZE + size;
+  arena->end = (char *)chunk + POOL_BUFFER_SIZE;
+  return (char *)chunk + CHUNK_HEADER_SIZE;
+}
+
+void free_chunks(Arena_chunk *chunk) {
+  while (chunk) {
+    Arena_chunk *next = chunk->next;
+    buffer_pool_put((char *)chunk, chunk->size);
+    chunk = next;
+  }
+}
+
+void arena_reset(Arena *arena) {
+  free_chunks(arena->spilled);
+  arena->spilled = NULL;
+
+  if (arena->first) {
+    arena->next = (char *)arena->first + CHUNK_HEADER_SIZE;
+    arena->end = (char *)arena->first + POOL_BUFFER_SIZE;
+  }
+}
+
+void arena_release(Arena *arena) {
+  free_chunks(arena->spilled);
+  free_chunks(arena->first);
+  arena_init(arena);
+}
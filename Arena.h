@@ -0,0 +1,46 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Bump-pointer scratch memory for one request at a time. Allocating is a
+// pointer bump inside a POOL_BUFFER_SIZE chunk from the thread's buffer
+// pool; when that runs out another pooled chunk is chained on, and an
+// allocation too big for any chunk gets a block of its own. Nothing is
+// freed individually: arena_reset() drops everything at once, keeping the
+// first chunk for the next request.
+
+#include "BufferPool.h"
+
+#define ARENA_ALIGNMENT 16
+
+// chunk data starts on an aligned boundary after the header
+#define ARENA_CHUNK_HEADER_SIZE                                                \
+  ((sizeof(Arena_chunk) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+// the most one allocation can take without a block of its own
+#define ARENA_CHUNK_CAPACITY (POOL_BUFFER_SIZE - (int)ARENA_CHUNK_HEADER_SIZE)
+
+typedef struct Arena_chunk {
+  struct Arena_chunk *next;
+  int size; // the whole allocation, this header included
+} Arena_chunk;
+
+typedef struct {
+  Arena_chunk *first; // kept across resets
+  Arena_chunk *spilled; // chained on since the last reset
+  char *next; // free space in the current chunk
+  char *end;
+} Arena;
+
+void arena_init(Arena *arena);
+
+// size bytes aligned to ARENA_ALIGNMENT, good until the next reset; NULL
+// if memory ran out
+void *arena_alloc(Arena *arena, int size);
+
+// O(1) unless the last request spilled into more chunks
+void arena_reset(Arena *arena);
+
+// gives every chunk back, the first one too; for idle connections
+void arena_release(Arena *arena);
+
+#endif
@@ -0,0 +1,36 @@
+#include <stdlib.h>
+
+#include "BufferPool.h"
+
+// free buffers are chained through their first bytes
+typedef struct Free_buffer {
+  struct Free_buffer *next;
+} Free_buffer;
+
+__thread Free_buffer *free_buffers = NULL;
+__thread int free_buffer_count = 0;
+
+char *buffer_pool_get(void) {
+  Free_buffer *buffer = free_buffers;
+  if (!buffer)
+    return malloc(POOL_BUFFER_SIZE);
+
+  free_buffers = buffer->next;
+  free_buffer_count--;
+  return (char *)buffer;
+}
+
+void buffer_pool_put(char *buffer, int size) {
+  if (!buffer)
+    return;
+
+  if (size != POOL_BUFFER_SIZE || free_buffer_count >= POOL_MAX_FREE) {
+    free(buffer);
+    return;
+  }
+
+  Free_buffer *freed = (Free_buffer *)buffer;
+  freed->next = free_buffers;
+  free_buffers = freed;
+  free_buffer_count++;
+}
@@ -0,0 +1,19 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+// Per-thread free lists of connection I/O buffers, so accepting a client
+// or starting a request reuses memory instead of going to malloc.
+// Only buffers of the standard size are pooled; a buffer that had to grow
+// for a big request goes back to the heap when it is handed back.
+
+#define POOL_BUFFER_SIZE 4096
+// most buffers one thread keeps around
+#define POOL_MAX_FREE 1024
+
+// a POOL_BUFFER_SIZE buffer, or NULL if malloc failed
+char *buffer_pool_get(void);
+
+// size is the buffer's current allocation; NULL is ignored
+void buffer_pool_put(char *buffer, int size);
+
+#endif
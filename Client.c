@@ -1,23 +1,182 @@
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
 #include "Client.h"
+#include "Latency.h"
+#include "Metrics.h"
+#include "Ticker.h"
+
+// IOV_MAX on Linux
+#define MAX_WRITEV_SEGMENTS 1024
+
+void pop_segment(Output_queue* queue);
+
+// Every Client lives in one preallocated table. Slots are cache-line
+// aligned, handed out from a lock-free free list (most recently freed
+// first, so reuse stays in cache), and only touched - so only backed by
+// memory - once first needed.
+typedef struct {
+  _Alignas(CACHE_LINE_SIZE) Client client;
+  unsigned generation; // bumped on every free; stale handles see a change
+  int next_free;
+  int in_use;
+} Client_slot;
+
+Client_slot *client_slots = NULL;
+int client_slot_count = 0;
+int client_slots_touched = 0; // slots below this have been used at least once
+// free list head: low 32 bits the slot index + 1 (0: empty), high 32 bits
+// a tag bumped by every change, so a pop can't be fooled by ABA
+unsigned long free_client_slots = 0;
+int next_client_id = 1;
+
+int client_table_init(int capacity)
+{
+  size_t size = (size_t)capacity * sizeof(Client_slot);
+  void *table = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (table == MAP_FAILED)
+  {
+    perror("mmap client table");
+    return FAIL;
+  }
+  client_slots = table;
+  client_slot_count = capacity;
+  return SUCCESS;
+}
+
+int take_free_slot(void)
+{
+  unsigned long head = __atomic_load_n(&free_client_slots, __ATOMIC_ACQUIRE);
+  while ((unsigned)head != 0)
+  {
+    int slot = (unsigned)head - 1;
+    unsigned long next = (head >> 32) + 1;
+    next = next << 32 |
+           (unsigned)(__atomic_load_n(&client_slots[slot].next_free,
+                                      __ATOMIC_RELAXED) + 1);
+    if (__atomic_compare_exchange_n(&free_client_slots, &head, next, 1,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+      return slot;
+  }
+
+  int slot = __atomic_fetch_add(&client_slots_touched, 1, __ATOMIC_RELAXED);
+  if (slot >= client_slot_count)
+  {
+    __atomic_fetch_sub(&client_slots_touched, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  return slot;
+}
 
-int next_client_index = 1;
+void put_free_slot(int slot)
+{
+  unsigned long head = __atomic_load_n(&free_client_slots, __ATOMIC_RELAXED);
+  unsigned long next;
+  do
+  {
+    __atomic_store_n(&client_slots[slot].next_free, (int)(unsigned)head - 1,
+                     __ATOMIC_RELAXED);
+    next = ((head >> 32) + 1) << 32 | (unsigned)(slot + 1);
+  } while (!__atomic_compare_exchange_n(&free_client_slots, &head, next, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
 Client *client_new( int sock_fd, struct sockaddr_in *addr)
 {
-  Client *cl = malloc(sizeof(Client));
+  int slot = take_free_slot();
+  if (slot == -1)
+    return NULL;
+
+  Client_slot *entry = &client_slots[slot];
+  __atomic_store_n(&entry->in_use, 1, __ATOMIC_RELAXED);
+  Client *cl = &entry->client;
+  cl->slot = slot;
+  cl->id = __atomic_fetch_add(&next_client_id, 1, __ATOMIC_RELAXED);
   cl->socket_fd = sock_fd;
   cl->address = *addr;
-  cl->id = next_client_index++;
 
+  cl->input = NULL;
+  cl->input_start = 0;
+  cl->input_length = 0;
+  cl->input_size = 0;
+  http_parser_reset(&cl->parser);
+  cl->request_length = 0;
+  arena_init(&cl->scratch);
+  cl->response_status = 0;
+  cl->response_bytes = 0;
+  cl->request_started_ns = 0;
+  cl->last_input_ns = 0;
+
+  cl->buffer_output = 0;
+  cl->batch_output = 0;
+  cl->queue_output = 0;
+  cl->queued.head = 0;
+  cl->queued.count = 0;
+  cl->queued.bytes = 0;
+  cl->hanging_up = 0;
+  cl->close_after_response = 0;
+  cl->output = NULL;
+  cl->output_length = 0;
+  cl->output_size = 0;
+  cl->unsent.count = 0;
+
+  cl->timeouts = NULL;
+  memset(&cl->timeout, 0, sizeof(cl->timeout));
+  cl->timeout.owner = cl;
+  cl->waiting_for = -1;
+
+  metrics_count(METRIC_CONNECTIONS_ACCEPTED);
   return cl;
 }
 
 void client_free(Client* cl)
 {
+  if (cl->timeouts)
+    timer_wheel_cancel(cl->timeouts, &cl->timeout);
   if (cl->socket_fd != 0)
     close(cl->socket_fd);
   
-  free(cl);
+  buffer_pool_put(cl->input, cl->input_size);
+  buffer_pool_put(cl->output, cl->output_size);
+  while (cl->queued.count > 0)
+    pop_segment(&cl->queued);
+  arena_release(&cl->scratch);
+
+  Client_slot *entry = &client_slots[cl->slot];
+  __atomic_store_n(&entry->generation, entry->generation + 1,
+                   __ATOMIC_RELEASE);
+  __atomic_store_n(&entry->in_use, 0, __ATOMIC_RELAXED);
+  put_free_slot(cl->slot);
+  metrics_count(METRIC_CONNECTIONS_CLOSED);
+}
+
+Client_handle client_handle(Client* cl)
+{
+  Client_handle handle = {
+      .slot = cl->slot,
+      .generation = __atomic_load_n(&client_slots[cl->slot].generation,
+                                    __ATOMIC_ACQUIRE)};
+  return handle;
+}
+
+Client *client_from_handle(Client_handle handle)
+{
+  Client_slot *entry = &client_slots[handle.slot];
+  if (__atomic_load_n(&entry->generation, __ATOMIC_ACQUIRE) !=
+          handle.generation ||
+      !__atomic_load_n(&entry->in_use, __ATOMIC_RELAXED))
+    return NULL;
+  return &entry->client;
 }
 
 int client_socket(Client* cl)
@@ -30,20 +189,781 @@ struct sockaddr_in client_address(Client* cl)
   return cl->address;
 }
 
+// makes sure *buf can hold needed bytes; doubles from initial_size,
+// starting from a pooled buffer when that is big enough
+int grow_buffer(char **buf, int *size, long needed, int initial_size)
+{
+  if (needed <= *size)
+    return SUCCESS;
+
+  // sizes are ints: anything bigger has to be sent in pieces
+  if (needed > INT_MAX)
+  {
+    fputs("buffer would grow past INT_MAX\n", stderr);
+    return FAIL;
+  }
+
+  if (*buf == NULL && initial_size == POOL_BUFFER_SIZE &&
+      needed <= POOL_BUFFER_SIZE)
+  {
+    *buf = buffer_pool_get();
+    if (!*buf)
+      return FAIL;
+    *size = POOL_BUFFER_SIZE;
+    return SUCCESS;
+  }
+
+  long new_size = *size ? *size : initial_size;
+  while (new_size < needed)
+    new_size *= 2;
+  if (new_size > INT_MAX)
+    new_size = INT_MAX;
+
+  char *grown = realloc(*buf, new_size);
+  if (!grown)
+    return FAIL;
+
+  *buf = grown;
+  *size = new_size;
+  return SUCCESS;
+}
+
+// non-blocking socket with a full send buffer: wait it out
+void wait_until_writable(Client* cl)
+{
+  struct pollfd pfd = { .fd = cl->socket_fd, .events = POLLOUT };
+  poll(&pfd, 1, -1);
+}
+
 int client_write(Client* cl, char* buffer)
 {
-  int result = write(cl->socket_fd, buffer, strlen(buffer));
+  return client_write_length(cl, buffer, strlen(buffer));
+}
+
+int client_write_length(Client* cl, const char* buffer, int length)
+{
+  struct iovec segment = { .iov_base = (void *)buffer, .iov_len = length };
+  return client_writev(cl, &segment, 1);
+}
+
+// set while this thread copies response bytes; see client_catch_copy_faults()
+__thread sigjmp_buf *copy_guard = NULL;
+
+void copy_fault(int signal_number)
+{
+  if (copy_guard)
+    siglongjmp(*copy_guard, 1);
+
+  // Not one of ours: returning would only fault again. Go down here, with
+  // a core as SIGBUS gives, rather than put the default action back for
+  // the whole process - other threads' copies still need the handler.
+  abort();
+}
+
+void client_catch_copy_faults(void)
+{
+  // SA_NODEFER: leaving the handler by siglongjmp mustn't leave SIGBUS
+  // blocked
+  struct sigaction action = {.sa_handler = copy_fault, .sa_flags = SA_NODEFER};
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGBUS, &action, NULL);
+}
+
+// Only ever left early by copy_fault(). memcpy() holds no locks and keeps
+// no state, so abandoning it part way is safe; the locals are volatile so
+// none of them is left stale by the jump.
+int copy_segments(char* out, struct iovec* segments, int count)
+{
+  char *volatile next = out;
+  volatile int i = 0;
+
+  sigjmp_buf guard;
+  if (sigsetjmp(guard, 0))
+  {
+    copy_guard = NULL;
+    return FAIL;
+  }
+  copy_guard = &guard;
+
+  for (; i < count; i++)
+  {
+    memcpy(next, segments[i].iov_base, segments[i].iov_len);
+    next += segments[i].iov_len;
+  }
+
+  copy_guard = NULL;
+  return SUCCESS;
+}
+
+// appends the segments to the output buffer (io_uring mode)
+int queue_output(Client* cl, struct iovec* segments, int count)
+{
+  long total = 0;
+  for (int i = 0; i < count; i++)
+    total += segments[i].iov_len;
+
+  if (grow_buffer(&cl->output, &cl->output_size, cl->output_length + total,
+                  CLIENT_INITIAL_INPUT_SIZE) == FAIL)
+    return FAIL;
+
+  if (copy_segments(cl->output + cl->output_length, segments, count) == FAIL)
+  {
+    fputs("response source truncated while copying\n", stderr);
+    metrics_count(METRIC_IO_ERRORS);
+    return FAIL;
+  }
+  cl->output_length += total;
+
+  return SUCCESS;
+}
+
+// writev() until every segment is out - or, unless block is set, until
+// the socket is full. The array is used as scratch space: segments that
+// went out are left empty and a partial one is trimmed to what remains.
+int write_segments(Client* cl, struct iovec* segments, int count, int block)
+{
+  while (count > 0)
+  {
+    // skip finished (or empty) segments
+    if (segments->iov_len == 0)
+    {
+      segments++;
+      count--;
+      continue;
+    }
+
+    ssize_t result = writev(cl->socket_fd, segments,
+                            count > MAX_WRITEV_SEGMENTS ? MAX_WRITEV_SEGMENTS : count);
+
+    if (result == -1 && errno == EINTR)
+      continue;
+
+    if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      if (!block)
+        return SUCCESS;
+      wait_until_writable(cl);
+      continue;
+    }
+
+    if (result == -1)
+    {
+      perror("write failed");
+      metrics_count(METRIC_IO_ERRORS);
+      return FAIL;
+    }
+    metrics_add(METRIC_BYTES_OUT, result);
+
+    // consume what went out; a partial segment resumes where it stopped
+    while (count > 0 && result >= (ssize_t)segments->iov_len)
+    {
+      result -= segments->iov_len;
+      segments->iov_len = 0;
+      segments++;
+      count--;
+    }
+    if (count > 0)
+    {
+      segments->iov_base = (char *)segments->iov_base + result;
+      segments->iov_len -= result;
+    }
+  }
+
+  return SUCCESS;
+}
+
+// sendfile() from *offset up to length - all of it, or (unless block is
+// set) as much as the socket takes right now
+int send_file_range(Client* cl, int file_fd, off_t* offset, long length,
+                    int block)
+{
+  while (*offset < length)
+  {
+    ssize_t result = sendfile(cl->socket_fd, file_fd, offset, length - *offset);
+
+    if (result == -1 && errno == EINTR)
+      continue;
+
+    if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      if (!block)
+        return SUCCESS;
+      wait_until_writable(cl);
+      continue;
+    }
+
+    if (result == -1)
+    {
+      perror("sendfile failed");
+      metrics_count(METRIC_IO_ERRORS);
+      return FAIL;
+    }
+    metrics_add(METRIC_BYTES_OUT, result);
+
+    // the file shrank under us; the Content-Length is already out
+    if (result == 0)
+      return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+int push_segment(Output_queue* queue, Output_segment* segment)
+{
+  if (queue->count == CLIENT_MAX_QUEUED_SEGMENTS)
+  {
+    fputs("output queue full\n", stderr);
+    return FAIL;
+  }
+
+  queue->segments[(queue->head + queue->count) % CLIENT_MAX_QUEUED_SEGMENTS] =
+      *segment;
+  queue->count++;
+  queue->bytes += segment->end - segment->offset;
+  return SUCCESS;
+}
+
+// takes the oldest segment off the queue; it is the caller's now
+Output_segment take_segment(Output_queue* queue)
+{
+  Output_segment segment = queue->segments[queue->head];
+  queue->bytes -= segment.end - segment.offset;
+  queue->head = (queue->head + 1) % CLIENT_MAX_QUEUED_SEGMENTS;
+  queue->count--;
+  return segment;
+}
+
+void pop_segment(Output_queue* queue)
+{
+  Output_segment segment = take_segment(queue);
+  if (segment.data)
+    buffer_pool_put(segment.data, segment.size);
+  else
+    close(segment.file_fd);
+}
+
+// the stretch [offset, end) of file_fd goes on the queue behind what is
+// there; the caller closes its fd, so the queue keeps a dup
+int queue_file(Client* cl, int file_fd, long offset, long end)
+{
+  Output_segment rest = {.data = NULL,
+                         .file_fd = dup(file_fd),
+                         .offset = offset,
+                         .end = end};
+  if (rest.file_fd == -1)
+  {
+    perror("dup");
+    return FAIL;
+  }
+  if (push_segment(&cl->queued, &rest) == FAIL)
+  {
+    close(rest.file_fd);
+    return FAIL;
+  }
+  return SUCCESS;
+}
+
+// the batch buffer joins the queue as it is, without a copy
+int queue_batch(Client* cl)
+{
+  if (cl->output_length == 0)
+    return SUCCESS;
+
+  Output_segment segment = {.data = cl->output,
+                            .size = cl->output_size,
+                            .file_fd = -1,
+                            .offset = 0,
+                            .end = cl->output_length};
+  if (push_segment(&cl->queued, &segment) == FAIL)
+    return FAIL;
+
+  cl->output = NULL;
+  cl->output_size = 0;
+  cl->output_length = 0;
+  return SUCCESS;
+}
+
+// sends queued segments in order until the socket is full
+int drain_queue(Client* cl)
+{
+  Output_queue *queue = &cl->queued;
+
+  while (queue->count > 0)
+  {
+    Output_segment *segment = &queue->segments[queue->head];
+    long before = segment->offset;
+
+    if (segment->data)
+    {
+      struct iovec rest = {.iov_base = segment->data + segment->offset,
+                           .iov_len = segment->end - segment->offset};
+      if (write_segments(cl, &rest, 1, 0) == FAIL)
+        return FAIL;
+      segment->offset = segment->end - rest.iov_len;
+    }
+    else
+    {
+      off_t offset = segment->offset;
+      if (send_file_range(cl, segment->file_fd, &offset, segment->end, 0) ==
+          FAIL)
+        return FAIL;
+      segment->offset = offset;
+    }
+
+    queue->bytes -= segment->offset - before;
+    if (segment->offset < segment->end)
+      return SUCCESS; // full; EPOLLOUT brings us back
+    pop_segment(queue);
+  }
+
+  return SUCCESS;
+}
+
+int client_output_pending(Client* cl)
+{
+  return cl->queued.count > 0 || cl->output_length > 0;
+}
+
+int client_output_blocked(Client* cl)
+{
+  // a response can add the batch buffer and a file
+  return cl->queued.bytes + cl->output_length >= CLIENT_OUTPUT_HIGH_WATER ||
+         cl->queued.count > CLIENT_MAX_QUEUED_SEGMENTS - 2;
+}
+
+// queue_output: small responses batch up; a big one goes out behind the
+// batch as far as the socket allows, straight from the caller's memory,
+// and only what's left over is copied
+int write_or_queue(Client* cl, struct iovec* segments, int count, long total)
+{
+  if (cl->output_length + total <= CLIENT_BATCH_LIMIT || cl->queued.count > 0)
+    return queue_output(cl, segments, count);
+
+  struct iovec all[count + 1];
+  all[0].iov_base = cl->output;
+  all[0].iov_len = cl->output_length;
+  memcpy(all + 1, segments, count * sizeof(struct iovec));
+
+  if (write_segments(cl, all, count + 1, 0) == FAIL)
+    return FAIL;
+
+  // whatever is left of the batch moves to the front of its buffer
+  if (all[0].iov_len > 0)
+    memmove(cl->output, all[0].iov_base, all[0].iov_len);
+  cl->output_length = all[0].iov_len;
+  return queue_output(cl, all + 1, count);
+}
+
+int client_writev(Client* cl, struct iovec* segments, int count)
+{
+  long total = 0;
+  for (int i = 0; i < count; i++)
+    total += segments[i].iov_len;
+  cl->response_bytes += total;
+
+  if (cl->buffer_output)
+    return queue_output(cl, segments, count);
+
+  if (cl->queue_output)
+    return write_or_queue(cl, segments, count, total);
+
+  if (!cl->batch_output)
+    return write_segments(cl, segments, count, 1);
+
+  // small responses wait for the end of the batch
+  if (cl->output_length + total <= CLIENT_BATCH_LIMIT)
+    return queue_output(cl, segments, count);
+
+  // a big one goes out now, behind whatever is queued, without copying it
+  if (cl->output_length == 0)
+    return write_segments(cl, segments, count, 1);
+
+  struct iovec all[count + 1];
+  all[0].iov_base = cl->output;
+  all[0].iov_len = cl->output_length;
+  memcpy(all + 1, segments, count * sizeof(struct iovec));
+  cl->output_length = 0;
+
+  return write_segments(cl, all, count + 1, 1);
+}
+
+int client_flush_output(Client* cl)
+{
+  if (cl->buffer_output)
+    return SUCCESS;
 
-  if (result == -1)
+  if (cl->queue_output)
   {
-    perror("write failed");
+    if (queue_batch(cl) == FAIL || drain_queue(cl) == FAIL)
+      return FAIL;
+    if (cl->queued.count == 0)
+      client_responses_sent(&cl->unsent);
+    return SUCCESS;
+  }
+
+  // big responses went straight out when they were written
+  if (cl->output_length == 0)
+  {
+    client_responses_sent(&cl->unsent);
+    return SUCCESS;
+  }
+
+  struct iovec queued = { .iov_base = cl->output, .iov_len = cl->output_length };
+  cl->output_length = 0;
+  int result = write_segments(cl, &queued, 1, 1);
+
+  // idle connections hold no output buffer
+  buffer_pool_put(cl->output, cl->output_size);
+  cl->output = NULL;
+  cl->output_size = 0;
+
+  if (result != FAIL)
+    client_responses_sent(&cl->unsent);
+  return result;
+}
+
+void client_response_queued(Client* cl, int route)
+{
+  Unsent_responses *unsent = &cl->unsent;
+
+  if (unsent->count == CLIENT_MAX_UNSENT_RESPONSES)
+  {
+    latency_record(route, latency_now_ns() - cl->request_started_ns);
+    return;
+  }
+
+  unsent->routes[unsent->count] = route;
+  unsent->started_ns[unsent->count] = cl->request_started_ns;
+  unsent->count++;
+}
+
+void client_responses_sent(Unsent_responses* unsent)
+{
+  if (unsent->count == 0)
+    return;
+
+  long now = latency_now_ns();
+  for (int i = 0; i < unsent->count; i++)
+    latency_record(unsent->routes[i], now - unsent->started_ns[i]);
+  unsent->count = 0;
+}
+
+// exactly length bytes of file_fd from offset into out
+int read_file(int file_fd, char* out, long offset, long length)
+{
+  long done = 0;
+  while (done < length)
+  {
+    ssize_t result = pread(file_fd, out + done, length - done, offset + done);
+    if (result == -1 && errno == EINTR)
+      continue;
+    if (result <= 0)
+    {
+      // the file shrank under us; the Content-Length may already be out
+      if (result == -1)
+        perror("pread");
+      metrics_count(METRIC_IO_ERRORS);
+      return FAIL;
+    }
+    done += result;
+  }
+  return SUCCESS;
+}
+
+int client_sendfile(Client* cl, int file_fd, long length)
+{
+  cl->response_bytes += length;
+
+  // io_uring: a small file is read in behind its header; a bigger one
+  // waits on the queue and is read a chunk at a time as
+  // client_next_output() hands it to the loop
+  if (cl->buffer_output)
+  {
+    if (length > CLIENT_BATCH_LIMIT || cl->queued.count > 0)
+    {
+      if (queue_batch(cl) == FAIL)
+        return FAIL;
+      return queue_file(cl, file_fd, 0, length);
+    }
+
+    if (grow_buffer(&cl->output, &cl->output_size, cl->output_length + length,
+                    CLIENT_INITIAL_INPUT_SIZE) == FAIL)
+      return FAIL;
+    if (read_file(file_fd, cl->output + cl->output_length, 0, length) == FAIL)
+      return FAIL;
+    cl->output_length += length;
+    return SUCCESS;
+  }
+
+  // the file's header (and anything before it) must go out first
+  if (client_flush_output(cl) == FAIL)
+    return FAIL;
+
+  off_t offset = 0;
+  if (!cl->queue_output)
+    return send_file_range(cl, file_fd, &offset, length, 1);
+
+  if (cl->queued.count == 0 &&
+      send_file_range(cl, file_fd, &offset, length, 0) == FAIL)
     return FAIL;
+  if (offset == length)
+    return SUCCESS;
+
+  // the rest waits its turn
+  return queue_file(cl, file_fd, offset, length);
+}
+
+int client_next_output(Client* cl, char** buffer, int* size, int* length,
+                       int max_file_chunk)
+{
+  Output_queue *queue = &cl->queued;
+  *length = 0;
+
+  if (queue->count == 0)
+  {
+    // the batch buffer trades places with the one that just went out
+    char *swap_buffer = *buffer;
+    int swap_size = *size;
+    *buffer = cl->output;
+    *size = cl->output_size;
+    *length = cl->output_length;
+    cl->output = swap_buffer;
+    cl->output_size = swap_size;
+    cl->output_length = 0;
+    return SUCCESS;
+  }
+
+  Output_segment *segment = &queue->segments[queue->head];
+  if (segment->data)
+  {
+    buffer_pool_put(*buffer, *size);
+    Output_segment taken = take_segment(queue);
+    *buffer = taken.data;
+    *size = taken.size;
+    *length = taken.end;
+    return SUCCESS;
   }
 
+  long chunk = segment->end - segment->offset;
+  if (chunk > max_file_chunk)
+    chunk = max_file_chunk;
+  if (grow_buffer(buffer, size, chunk, CLIENT_INITIAL_INPUT_SIZE) == FAIL)
+    return FAIL;
+
+  if (read_file(segment->file_fd, *buffer, segment->offset, chunk) == FAIL)
+    return FAIL;
+
+  segment->offset += chunk;
+  queue->bytes -= chunk;
+  if (segment->offset == segment->end)
+    pop_segment(queue);
+  *length = chunk;
   return SUCCESS;
 }
 
 int client_id(Client* cl)
 {
   return cl->id;
-}
\ No newline at end of file
+}
+
+// Makes room for needed more bytes (plus the NUL), first by sliding the
+// unhandled input back to the front, then by growing.
+int make_input_room(Client* cl, int needed, int max_length)
+{
+  int pending = cl->input_length - cl->input_start;
+  if (pending + needed > max_length)
+    return FAIL;
+
+  if (cl->input_size - cl->input_length > needed)
+    return SUCCESS;
+
+  if (cl->input_start > 0)
+  {
+    // parser offsets are relative to input_start, so they stay valid
+    memmove(cl->input, cl->input + cl->input_start, pending);
+    cl->input_start = 0;
+    cl->input_length = pending;
+    cl->input[pending] = '\0';
+  }
+
+  return grow_buffer(&cl->input, &cl->input_size, cl->input_length + needed + 1,
+                     CLIENT_INITIAL_INPUT_SIZE);
+}
+
+// call before appending new input: a request starts with its first byte
+void note_input_arrived(Client* cl)
+{
+  cl->last_input_ns = latency_now_ns();
+  if (cl->input_length == cl->input_start)
+    cl->request_started_ns = cl->last_input_ns;
+}
+
+// one read() into the free end of the input buffer; returns what read()
+// did, or -1 with errno = EMSGSIZE when the input outgrew max_length
+int read_into_input(Client* cl, int max_length)
+{
+  int wanted = cl->input_size - cl->input_length - 1;
+  if (wanted < CLIENT_INITIAL_INPUT_SIZE / 2)
+    wanted = CLIENT_INITIAL_INPUT_SIZE / 2;
+  if (wanted > max_length - (cl->input_length - cl->input_start))
+    wanted = max_length - (cl->input_length - cl->input_start);
+
+  if (wanted <= 0 || make_input_room(cl, wanted, max_length) == FAIL)
+  {
+    errno = EMSGSIZE;
+    return -1;
+  }
+
+  int amount_read = read(cl->socket_fd, cl->input + cl->input_length,
+                         cl->input_size - cl->input_length - 1);
+  if (amount_read > 0)
+  {
+    note_input_arrived(cl);
+    metrics_add(METRIC_BYTES_IN, amount_read);
+    cl->input_length += amount_read;
+    cl->input[cl->input_length] = '\0';
+  }
+
+  return amount_read;
+}
+
+int client_read_input(Client* cl, int max_length)
+{
+  client_arm_timeout(cl);
+
+  while (1)
+  {
+    int amount_read = read_into_input(cl, max_length);
+
+    if (amount_read > 0)
+      return SUCCESS;
+    if (amount_read == 0)
+      return CONNECTION_CLOSED;
+    if (errno == EINTR)
+      continue;
+
+    perror("client_read_input");
+    metrics_count(METRIC_IO_ERRORS);
+    return FAIL;
+  }
+}
+
+int client_fill_input(Client* cl, int max_length)
+{
+  while (1)
+  {
+    int amount_read = read_into_input(cl, max_length);
+
+    if (amount_read > 0)
+      continue;
+    if (amount_read == 0)
+      return CONNECTION_CLOSED;
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return SUCCESS;
+
+    perror("client_fill_input");
+    metrics_count(METRIC_IO_ERRORS);
+    return FAIL;
+  }
+}
+
+int client_append_input(Client* cl, const char* data, int length, int max_length)
+{
+  if (make_input_room(cl, length, max_length) == FAIL)
+    return FAIL;
+
+  note_input_arrived(cl);
+  memcpy(cl->input + cl->input_length, data, length);
+  metrics_add(METRIC_BYTES_IN, length);
+  cl->input_length += length;
+  cl->input[cl->input_length] = '\0';
+  return SUCCESS;
+}
+
+int client_next_request(Client* cl, char** request, int* length, int max_length)
+{
+  int request_length;
+  int result = http_parser_feed(&cl->parser, cl->input + cl->input_start,
+                                cl->input_length - cl->input_start, max_length,
+                                &request_length);
+  if (result != SUCCESS)
+    return result;
+
+  // terminate in place; the byte we overwrite belongs to the next request
+  char *end = cl->input + cl->input_start + request_length;
+  cl->byte_after_request = *end;
+  *end = '\0';
+  cl->request_length = request_length;
+
+  *request = cl->input + cl->input_start + cl->parser.skip;
+  *length = request_length - cl->parser.skip;
+  return SUCCESS;
+}
+
+void client_finish_request(Client* cl)
+{
+  cl->input[cl->input_start + cl->request_length] = cl->byte_after_request;
+  cl->input_start += cl->request_length;
+  cl->request_length = 0;
+
+  if (cl->input_start == cl->input_length)
+  {
+    cl->input_start = 0;
+    cl->input_length = 0;
+  }
+  else
+  {
+    // a pipelined request, there since the latest read at the latest
+    cl->request_started_ns = cl->last_input_ns;
+  }
+
+  http_parser_reset(&cl->parser);
+  arena_reset(&cl->scratch);
+}
+
+void *client_scratch(Client* cl, int size)
+{
+  return arena_alloc(&cl->scratch, size);
+}
+
+void client_release_idle_input(Client* cl)
+{
+  if (cl->input_length > cl->input_start || cl->request_length)
+    return;
+
+  buffer_pool_put(cl->input, cl->input_size);
+  cl->input = NULL;
+  cl->input_start = 0;
+  cl->input_length = 0;
+  cl->input_size = 0;
+  arena_release(&cl->scratch);
+}
+
+void client_arm_timeout(Client* cl)
+{
+  if (!cl->timeouts)
+    return;
+
+  int waiting_for = CLIENT_WAITING_IDLE;
+  if (cl->input_length > cl->input_start)
+    waiting_for = cl->parser.state == PARSE_BODY ? CLIENT_WAITING_BODY
+                                                 : CLIENT_WAITING_HEADERS;
+  // requests held back behind queued output aren't the client's delay
+  if (client_output_pending(cl))
+    waiting_for = CLIENT_WAITING_OUTPUT;
+
+  // idle and output deadlines restart whenever something happens
+  if (waiting_for == cl->waiting_for && waiting_for != CLIENT_WAITING_IDLE &&
+      waiting_for != CLIENT_WAITING_OUTPUT)
+    return;
+  cl->waiting_for = waiting_for;
+
+  static const long timeouts_ns[] = {CLIENT_IDLE_TIMEOUT_NS,
+                                     CLIENT_HEADER_TIMEOUT_NS,
+                                     CLIENT_BODY_TIMEOUT_NS,
+                                     CLIENT_SEND_TIMEOUT_NS};
+  timer_wheel_arm(cl->timeouts, &cl->timeout,
+                  ticker_monotonic_ns() + timeouts_ns[waiting_for]);
+}
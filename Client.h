@@ -1,4 +1,10 @@
 #include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include "Arena.h"
+#include "BufferPool.h"
+#include "HttpParser.h"
+#include "TimerWheel.h"
 
 #ifndef CLIENT_H
 #define CLIENT_H
@@ -6,24 +12,215 @@
 #define FAIL 0
 #define NONEXISTENT_FILE 1
 #define SUCCESS 2
+#define CONNECTION_CLOSED 3
+
+// first allocation for a client's buffers (from the thread's pool); they
+// double from there only when a request or response needs the room
+#define CLIENT_INITIAL_INPUT_SIZE POOL_BUFFER_SIZE
+// most response bytes batch_output queues before writing
+#define CLIENT_BATCH_LIMIT (64 * 1024)
+// queue_output: what the socket hasn't taken yet, in pieces; past either
+// limit the connection stops reading and handling requests until the
+// queue drains
+#define CLIENT_MAX_QUEUED_SEGMENTS 16
+#define CLIENT_OUTPUT_HIGH_WATER (256 * 1024)
+// responses whose latency waits on the next flush; beyond this they are
+// timed when queued
+#define CLIENT_MAX_UNSENT_RESPONSES 32
+
+// How long a connection may sit idle between requests, and take over
+// sending one request's headers and its body. The header and body
+// deadlines run from when that part started arriving, so trickling bytes
+// in doesn't extend them. While output is queued, the clock is how long
+// the client may go without taking any of it.
+#define CLIENT_IDLE_TIMEOUT_NS (60 * 1000000000L)
+#define CLIENT_HEADER_TIMEOUT_NS (10 * 1000000000L)
+#define CLIENT_BODY_TIMEOUT_NS (30 * 1000000000L)
+#define CLIENT_SEND_TIMEOUT_NS (30 * 1000000000L)
+
+#define CLIENT_WAITING_IDLE 0
+#define CLIENT_WAITING_HEADERS 1
+#define CLIENT_WAITING_BODY 2
+#define CLIENT_WAITING_OUTPUT 3
 
+// Output the socket wouldn't take yet, oldest first: a buffer of bytes
+// (owned by the queue) or a stretch of a file (a dup of its fd).
+typedef struct {
+  char *data; // NULL for a file
+  int size;   // data's allocation
+  int file_fd;
+  long offset; // next byte to send
+  long end;
+} Output_segment;
+
+typedef struct {
+  int head;
+  int count;
+  long bytes; // still to send, over every segment
+  Output_segment segments[CLIENT_MAX_QUEUED_SEGMENTS];
+} Output_queue;
 
+// Responses handed to the client but maybe not written yet, with when
+// their requests started arriving. They are timed once the output is out.
 typedef struct {
-  int id;
+  int count;
+  int routes[CLIENT_MAX_UNSENT_RESPONSES];
+  long started_ns[CLIENT_MAX_UNSENT_RESPONSES];
+} Unsent_responses;
+
+typedef struct {
+  int id;   // unique for the life of the server
+  int slot; // in the client table
   int socket_fd;
   struct sockaddr_in address;
+
+  // bytes received but not yet handled; may hold a partial request or
+  // several pipelined ones
+  char *input;
+  int input_start;  // first byte of the request being parsed
+  int input_length; // end of what we have received
+  int input_size;
+  Http_parser parser;
+  int request_length; // of the request client_next_request() handed out
+  Arena scratch;      // the current request's; see client_scratch()
+  char byte_after_request;
+  long request_started_ns; // first byte of the current request arrived
+  long last_input_ns;      // the latest read
+  // what went back for the current request, for the access log
+  int response_status;
+  long response_bytes;
+
+  // when set, client_write() only queues bytes here and the serving loop
+  // sends them itself (io_uring mode)
+  int buffer_output;
+  // when set, responses up to CLIENT_BATCH_LIMIT are queued here until
+  // client_flush_output(), so a batch of pipelined requests is answered
+  // with one write
+  int batch_output;
+  // when set (epoll mode), writing never blocks: batches as batch_output
+  // does, and whatever the socket won't take goes on the queue for
+  // client_flush_output() to send once it is writable again
+  int queue_output;
+  Output_queue queued;
+  int hanging_up; // close once the queue has drained
+  // draining for an upgrade: the response being made is the last one,
+  // sent with Connection: close
+  int close_after_response;
+  char *output;
+  int output_length;
+  int output_size;
+  Unsent_responses unsent;
+
+  // the wheel timeout is armed on (NULL: no timeouts) and which of the
+  // deadlines it is
+  Timer_wheel *timeouts;
+  Timer timeout;
+  int waiting_for;
 } Client;
 
+// Names a client without keeping it alive: once it is freed (and its
+// slot perhaps reused) the handle no longer resolves.
+typedef struct {
+  int slot;
+  unsigned generation;
+} Client_handle;
+
+// Sets aside room for capacity clients at once; call before client_new().
+// Memory is only committed as slots are first used.
+int client_table_init(int capacity);
+
+// NULL when the table is full; the caller still owns sock_fd then
 Client *client_new( int sock_fd, struct sockaddr_in *addr);
 
 // closes socket also
 void client_free(Client* cl);
 
+Client_handle client_handle(Client* cl);
+// the client, or NULL if it has been freed since
+Client *client_from_handle(Client_handle handle);
+
 int client_socket(Client* cl);
 struct sockaddr_in client_address(Client* cl);
 
 int client_write(Client* cl, char* buffer);
+// binary-safe: exactly length bytes
+int client_write_length(Client* cl, const char* buffer, int length);
+
+// Writes every segment, in order, with as few writev() calls as the socket
+// allows - short writes pick up mid-segment. The iovec array is used as
+// scratch space.
+int client_writev(Client* cl, struct iovec* segments, int count);
+
+// Writes whatever batch_output has queued. With queue_output, sends what
+// it can of the queue and leaves the rest for next time.
+int client_flush_output(Client* cl);
+// queue_output: responses still waiting for the socket
+int client_output_pending(Client* cl);
+// queue_output: so much is waiting that no more requests should be read
+// or handled until the socket catches up
+int client_output_blocked(Client* cl);
+
+// The current request's response (for route) has been handed over; its
+// latency is recorded once the output is flushed.
+void client_response_queued(Client* cl, int route);
+// records the latencies of responses that have now gone out
+void client_responses_sent(Unsent_responses* unsent);
+
+// Sends length bytes of file_fd, from its start, with sendfile(). When
+// output is being buffered (io_uring mode) a small file is read into the
+// output buffer; a big one is queued for client_next_output() to read out
+// in pieces.
+int client_sendfile(Client* cl, int file_fd, long length);
+
+// buffer_output: moves the next stretch of output, in order, into
+// *buffer (*size its allocation, *length what to send) for the serving
+// loop to send. What *buffer held is reused or given back. A queued file
+// is read at most max_file_chunk bytes at a time, each piece only once
+// the one before it is out. *length is 0 when nothing is waiting; FAIL
+// if a file couldn't be read.
+int client_next_output(Client* cl, char** buffer, int* size, int* length,
+                       int max_file_chunk);
 
 int client_id(Client* cl);
 
+// One read() into the input buffer - for blocking sockets.
+// Returns FAIL on error or overflow, CONNECTION_CLOSED at end of stream,
+// otherwise SUCCESS.
+int client_read_input(Client* cl, int max_length);
+
+// Drains a non-blocking socket into the input buffer; same returns.
+int client_fill_input(Client* cl, int max_length);
+
+// Appends bytes that arrived some other way (e.g. a completed io_uring recv).
+// Returns FAIL if the unhandled input would grow past max_length.
+int client_append_input(Client* cl, const char* data, int length, int max_length);
+
+// Frames the next buffered request. On SUCCESS *request points at it,
+// NUL-terminated in place, with *length bytes; hand it back with
+// client_finish_request() before asking for another. Otherwise returns
+// REQUEST_INCOMPLETE (read more) or FAIL (unparseable - give up).
+int client_next_request(Client* cl, char** request, int* length, int max_length);
+void client_finish_request(Client* cl);
+
+// Memory for handling the current request, good until its
+// client_finish_request() - by then the response has been written or
+// copied into the output. NULL if memory ran out.
+void *client_scratch(Client* cl, int size);
+
+// Response bodies may point into MAP_SHARED file mappings, and a file
+// truncated in place turns reads of its lost pages into SIGBUS. Once
+// this is called, copying such a body into the output fails just that
+// response. (writev() and send() get EFAULT instead, which they report.)
+void client_catch_copy_faults(void);
+
+// Arms the timeout for what the client is now waiting on - the idle one
+// afresh, the header and body ones only as that part starts arriving.
+// No-op without a wheel.
+void client_arm_timeout(Client* cl);
+
+// Gives the input buffer and scratch memory back to the thread's pool if
+// nothing is waiting in the input, so idle connections hold no buffer. Non-blocking modes call this
+// after each batch of requests.
+void client_release_idle_input(Client* cl);
+
 #endif
@@ -0,0 +1,86 @@
+#include <string.h>
+
+#include "Client.h"
+#include "Decimal.h"
+
+int decimal_parse_unsigned(const char *text, int length, unsigned long max,
+                           unsigned long *value) {
+  if (length <= 0)
+    return FAIL;
+
+  // past this, one more digit could overflow max
+  unsigned long limit = max / 10;
+  unsigned long last_digit = max % 10;
+  unsigned long result = 0;
+
+  for (int i = 0; i < length; i++) {
+    unsigned long digit = (unsigned char)text[i] - '0';
+    if (digit > 9)
+      return FAIL;
+    if (result > limit || (result == limit && digit > last_digit))
+      return FAIL;
+    result = result * 10 + digit;
+  }
+
+  *value = result;
+  return SUCCESS;
+}
+
+int decimal_parse_signed(const char *text, int length, long min, long max,
+                         long *value) {
+  int negative = length > 0 && text[0] == '-';
+  if (length > 0 && (text[0] == '-' || text[0] == '+')) {
+    text++;
+    length--;
+  }
+
+  // magnitudes as unsigned, so -LONG_MIN doesn't overflow
+  unsigned long bound = negative ? -(unsigned long)min : (unsigned long)max;
+  if (negative ? min >= 0 : max < 0)
+    bound = 0;
+
+  unsigned long magnitude;
+  if (decimal_parse_unsigned(text, length, bound, &magnitude) == FAIL)
+    return FAIL;
+
+  // the bound only caps the side the sign is on: [5, 10] still has to
+  // turn away "3", and [-10, -5] "-3"
+  long result = negative ? (long)-magnitude : (long)magnitude;
+  if (result < min || result > max)
+    return FAIL;
+
+  *value = result;
+  return SUCCESS;
+}
+
+// "00" "01" ... "99": two digits per division
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536"
+    "37383940414243444546474849505152535455565758596061626364656667686970717273"
+    "7475767778798081828384858687888990919293949596979899";
+
+int decimal_format(long value, char *out) {
+  char digits[DECIMAL_MAX_LENGTH];
+  int start = DECIMAL_MAX_LENGTH;
+  unsigned long magnitude =
+      value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+  while (magnitude >= 100) {
+    int pair = (magnitude % 100) * 2;
+    magnitude /= 100;
+    digits[--start] = digit_pairs[pair + 1];
+    digits[--start] = digit_pairs[pair];
+  }
+  if (magnitude >= 10) {
+    digits[--start] = digit_pairs[magnitude * 2 + 1];
+    digits[--start] = digit_pairs[magnitude * 2];
+  } else {
+    digits[--start] = '0' + magnitude;
+  }
+  if (value < 0)
+    digits[--start] = '-';
+
+  int length = DECIMAL_MAX_LENGTH - start;
+  memcpy(out, digits + start, length);
+  return length;
+}
@@ -0,0 +1,25 @@
+#ifndef DECIMAL_H
+#define DECIMAL_H
+
+// Decimal text <-> integers for the request path: path parameters,
+// Content-Length and the numbers in generated responses. No locale, no
+// format strings, no allocation, and overflow is an error rather than a
+// wrapped value.
+
+// longest decimal long, sign included
+#define DECIMAL_MAX_LENGTH 20
+
+// Exactly text[0..length) as digits, at most max. Returns FAIL for empty
+// text, anything but digits, or a value over max.
+int decimal_parse_unsigned(const char *text, int length, unsigned long max,
+                           unsigned long *value);
+
+// The same with an optional leading '+' or '-', within [min, max].
+int decimal_parse_signed(const char *text, int length, long min, long max,
+                         long *value);
+
+// Writes value's digits (no NUL) to out, which has room for
+// DECIMAL_MAX_LENGTH bytes. Returns how many were written.
+int decimal_format(long value, char *out);
+
+#endif
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "EventLoop.h"
+#include "Handoff.h"
+#include "Metrics.h"
+#include "Server.h"
+#include "Ticker.h"
+
+#define MAX_EVENTS_PER_WAIT 256
+
+typedef struct {
+  int index;
+  int listen_socket;
+  int epoll_fd;
+  Timer_wheel timeouts; // every client of this loop's
+} Loop_data;
+
+void *event_loop_threadfunc(void *);
+
+int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    perror("fcntl O_NONBLOCK");
+    return FAIL;
+  }
+  return SUCCESS;
+}
+
+int event_loop_run(int *listen_sockets, int socket_count, int thread_count) {
+  for (int i = 0; i < socket_count; i++)
+    if (set_nonblocking(listen_sockets[i]) == FAIL)
+      return FAIL;
+
+  pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+  Loop_data *loops = malloc(thread_count * sizeof(Loop_data));
+
+  for (int i = 0; i < thread_count; i++) {
+    loops[i].index = i;
+    loops[i].listen_socket = listen_sockets[i % socket_count];
+    timer_wheel_init(&loops[i].timeouts, ticker_monotonic_ns(), NULL);
+    loops[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loops[i].epoll_fd == -1) {
+      perror("epoll_create1");
+      return FAIL;
+    }
+
+    // the listening socket stays level-triggered; EPOLLEXCLUSIVE keeps a
+    // single connection from waking every loop
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLEXCLUSIVE,
+                             .data.ptr = NULL};
+    if (epoll_ctl(loops[i].epoll_fd, EPOLL_CTL_ADD, loops[i].listen_socket,
+                  &ev) == -1) {
+      perror("epoll_ctl listen socket");
+      return FAIL;
+    }
+
+    int result = pthread_create(&threads[i], NULL, event_loop_threadfunc,
+                                (void *)&loops[i]);
+    if (result != 0) {
+      errno = result;
+      perror("pthread_create");
+      return FAIL;
+    }
+  }
+
+  if (debug)
+    fprintf(stderr, "%d event loop threads running\n", thread_count);
+
+  // an upgrade: the old server can stop accepting now
+  handoff_ready();
+
+  // loops only come back if something went badly wrong
+  for (int i = 0; i < thread_count; i++)
+    pthread_join(threads[i], NULL);
+
+  free(threads);
+  free(loops);
+  return FAIL;
+}
+
+// accept everything that is pending and hand it to this loop's epoll
+int event_loop_accept(Loop_data *loop) {
+  while (1) {
+    struct sockaddr_in client_addr;
+    socklen_t sock_len = sizeof(client_addr);
+
+    int new_socket_fd =
+        accept4(loop->listen_socket, (struct sockaddr *)&client_addr,
+                &sock_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (new_socket_fd < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return SUCCESS;
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      perror("accept failed");
+      // EMFILE and friends: leave it for the next wakeup
+      return SUCCESS;
+    }
+
+    Client *cl = client_new(new_socket_fd, &client_addr);
+    if (!cl) {
+      if (debug)
+        fputs("connection table full - refusing a client\n", stderr);
+      close(new_socket_fd);
+      continue;
+    }
+    cl->queue_output = 1;
+    cl->timeouts = &loop->timeouts;
+    client_arm_timeout(cl);
+
+    // EPOLLOUT too: edge-triggered, it only fires once a full socket has
+    // room again, which is when queued output can move
+    struct epoll_event ev = {.events =
+                                 EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                             .data.ptr = cl};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, new_socket_fd, &ev) == -1) {
+      perror("epoll_ctl client");
+      client_free(cl);
+      continue;
+    }
+
+    if (debug)
+      fprintf(stderr, "loop %d accepted client %d (fd %d)\n", loop->index,
+              client_id(cl), new_socket_fd);
+  }
+}
+
+// drop a client; closing the fd also removes it from the epoll set
+void event_loop_close(Loop_data *loop, Client *cl, const char *why) {
+  if (debug)
+    fprintf(stderr, "loop %d: client %d %s - closing\n", loop->index,
+            client_id(cl), why);
+  client_free(cl);
+}
+
+// Edge-triggered: we only hear about a socket once per batch of new data
+// (or once it has room to write again), so read it dry before going back
+// to epoll_wait. While a slow reader's output is backed up past the
+// high-water mark we neither read from it nor handle its requests; the
+// EPOLLOUT that comes when it catches up picks them up again.
+void event_loop_service(Loop_data *loop, Client *cl, uint32_t events) {
+  int result = SUCCESS;
+  int served = SUCCESS;
+
+  // what the socket wouldn't take last time goes first
+  if (client_flush_output(cl) == FAIL) {
+    event_loop_close(loop, cl, "write failed");
+    return;
+  }
+
+  if (!cl->hanging_up && !client_output_blocked(cl)) {
+    result = client_fill_input(cl, MAX_MESSAGE_LENGTH);
+    if (result == FAIL) {
+      event_loop_close(loop, cl, "read failed");
+      return;
+    }
+
+    // a request can arrive in pieces, or several at once; all the answers
+    // to this batch go out in one write. If serving stopped at the
+    // high-water mark but the flush then emptied the queue, no EPOLLOUT is
+    // coming, so carry on with the rest of the batch now.
+    while (1) {
+      served = serve_buffered_requests(cl);
+      int was_blocked = client_output_blocked(cl);
+      if (client_flush_output(cl) == FAIL) {
+        event_loop_close(loop, cl, "response failed");
+        return;
+      }
+      if (served != SUCCESS || !was_blocked || client_output_blocked(cl))
+        break;
+    }
+    client_release_idle_input(cl);
+  }
+
+  if (events & (EPOLLHUP | EPOLLERR)) {
+    event_loop_close(loop, cl, "closed socket");
+    return;
+  }
+
+  // the last answers (an error, or the Connection: close one while
+  // draining) still go out before we hang up
+  if (served != SUCCESS || result == CONNECTION_CLOSED)
+    cl->hanging_up = 1;
+  if (cl->hanging_up && !client_output_pending(cl)) {
+    event_loop_close(loop, cl, served == FAIL ? "response failed"
+                                              : "closed socket");
+    return;
+  }
+
+  client_arm_timeout(cl);
+}
+
+void event_loop_timed_out(void *context, void *owner) {
+  metrics_count(METRIC_TIMEOUTS);
+  event_loop_close((Loop_data *)context, (Client *)owner, "timed out");
+}
+
+void *event_loop_threadfunc(void *payload_ptr) {
+  Loop_data *loop = (Loop_data *)payload_ptr;
+  struct epoll_event events[MAX_EVENTS_PER_WAIT];
+
+  int accepting = 1;
+
+  pin_thread_to_cpu(loop->index);
+
+  while (1) {
+    // after an upgrade the new process does the accepting. The socket is
+    // still open there, so closing ours wouldn't take it out of the epoll
+    // set: it has to be removed by hand.
+    if (accepting && __atomic_load_n(&draining, __ATOMIC_ACQUIRE)) {
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, loop->listen_socket, NULL);
+      accepting = 0;
+      __atomic_sub_fetch(&accepting_loops, 1, __ATOMIC_RELEASE);
+    }
+
+    // wake at least once a tick to close whoever has run out of time
+    int count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS_PER_WAIT,
+                           TIMER_WHEEL_TICK_NS / 1000000);
+    if (count == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      return NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.ptr == NULL)
+        event_loop_accept(loop);
+      else
+        event_loop_service(loop, (Client *)events[i].data.ptr,
+                           events[i].events);
+    }
+
+    timer_wheel_expire(&loop->timeouts, ticker_monotonic_ns(),
+                       event_loop_timed_out, loop);
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+// Non-blocking serving mode: every loop thread owns an epoll instance,
+// watches a listening socket (EPOLLEXCLUSIVE, so a new connection wakes
+// only one of the loops sharing it) and multiplexes its own clients
+// edge-triggered.
+
+// Runs thread_count loop threads; loop i accepts on
+// listen_sockets[i % socket_count]. Only returns (FAIL) if the loops could
+// not be started or one of them died.
+int event_loop_run(int *listen_sockets, int socket_count, int thread_count);
+
+#endif
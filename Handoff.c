@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Handoff.h"
+#include "Server.h"
+
+extern char **environ;
+
+// the new process's end of the Unix socket, until it says it's ready
+int handoff_socket = -1;
+
+// one socket per message, so SCM_MAX_FD never gets in the way; the data
+// is how many more are coming
+int send_socket(int channel, int fd, int remaining) {
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+
+  struct iovec data = {.iov_base = &remaining, .iov_len = sizeof(remaining)};
+  struct msghdr message = {.msg_iov = &data,
+                           .msg_iovlen = 1,
+                           .msg_control = control,
+                           .msg_controllen = sizeof(control)};
+
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+  if (sendmsg(channel, &message, 0) == -1) {
+    perror("handoff sendmsg");
+    return FAIL;
+  }
+  return SUCCESS;
+}
+
+// returns the socket, or -1
+int receive_socket(int channel, int *remaining) {
+  char control[CMSG_SPACE(sizeof(int))];
+
+  struct iovec data = {.iov_base = remaining, .iov_len = sizeof(*remaining)};
+  struct msghdr message = {.msg_iov = &data,
+                           .msg_iovlen = 1,
+                           .msg_control = control,
+                           .msg_controllen = sizeof(control)};
+
+  ssize_t got = recvmsg(channel, &message, MSG_CMSG_CLOEXEC);
+  if (got == -1) {
+    perror("handoff recvmsg");
+    return -1;
+  }
+
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  if (got != sizeof(*remaining) || !header ||
+      header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+    fputs("handoff: expected a listening socket\n", stderr);
+    return -1;
+  }
+
+  int fd;
+  memcpy(&fd, CMSG_DATA(header), sizeof(int));
+  return fd;
+}
+
+// the new server writes a byte just before it starts serving
+int wait_until_ready(int channel) {
+  struct pollfd pfd = {.fd = channel, .events = POLLIN};
+  int result;
+  do
+    result = poll(&pfd, 1, HANDOFF_READY_TIMEOUT_MS);
+  while (result == -1 && errno == EINTR);
+
+  char ready;
+  if (result == 1 && read(channel, &ready, 1) == 1)
+    return SUCCESS;
+
+  fputs(result == 0 ? "handoff: new server didn't start in time\n"
+                    : "handoff: new server exited during startup\n",
+        stderr);
+  return FAIL;
+}
+
+int handoff_start(char *argv[], int *sockets, int count) {
+  // SEQPACKET keeps each socket's message separate
+  int channel[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, channel) == -1) {
+    perror("handoff socketpair");
+    return FAIL;
+  }
+
+  // our environment plus where to find the socket, built up front: between
+  // fork() and exec() only async-signal-safe calls are allowed
+  char variable[64];
+  snprintf(variable, sizeof(variable), HANDOFF_FD_VARIABLE "=%d", channel[1]);
+  int environ_count = 0;
+  while (environ[environ_count])
+    environ_count++;
+  char **env = malloc((environ_count + 2) * sizeof(char *));
+  int env_count = 0;
+  for (int i = 0; i < environ_count; i++)
+    if (strncmp(environ[i], HANDOFF_FD_VARIABLE "=",
+                strlen(HANDOFF_FD_VARIABLE "=")) != 0)
+      env[env_count++] = environ[i];
+  env[env_count++] = variable;
+  env[env_count] = NULL;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // the signal thread forked us with its signals blocked; the child end
+    // of the channel is the one fd that has to survive exec
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    fcntl(channel[1], F_SETFD, 0);
+    execvpe(argv[0], argv, env);
+    _exit(127);
+  }
+
+  free(env);
+  close(channel[1]);
+  if (pid == -1) {
+    perror("handoff fork");
+    close(channel[0]);
+    return FAIL;
+  }
+
+  if (debug)
+    fprintf(stderr, "handing %d listening socket(s) to %s (pid %d)\n", count,
+            argv[0], pid);
+
+  int result = SUCCESS;
+  for (int i = 0; i < count && result != FAIL; i++)
+    result = send_socket(channel[0], sockets[i], count - 1 - i);
+  if (result != FAIL)
+    result = wait_until_ready(channel[0]);
+  close(channel[0]);
+
+  // a new server that never got going mustn't also be accepting
+  if (result == FAIL) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+  }
+  return result;
+}
+
+int handoff_receive(int *sockets, int max, int *count) {
+  *count = 0;
+
+  char *variable = getenv(HANDOFF_FD_VARIABLE);
+  if (!variable)
+    return SUCCESS;
+
+  handoff_socket = atoi(variable);
+  fcntl(handoff_socket, F_SETFD, FD_CLOEXEC);
+  // our own upgrades start from scratch
+  unsetenv(HANDOFF_FD_VARIABLE);
+
+  int remaining = 1;
+  while (remaining > 0) {
+    int fd = receive_socket(handoff_socket, &remaining);
+    if (fd == -1)
+      return FAIL;
+    if (*count == max) {
+      fputs("handoff: too many listening sockets\n", stderr);
+      close(fd);
+      return FAIL;
+    }
+    sockets[(*count)++] = fd;
+  }
+
+  if (debug)
+    fprintf(stderr, "took over %d listening socket(s)\n", *count);
+  return SUCCESS;
+}
+
+void handoff_ready(void) {
+  if (handoff_socket == -1)
+    return;
+
+  if (write(handoff_socket, "r", 1) != 1)
+    perror("handoff ready");
+  close(handoff_socket);
+  handoff_socket = -1;
+}
@@ -0,0 +1,35 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+// Zero-downtime upgrades. On SIGUSR2 the running server starts its binary
+// again (same path, same arguments) and passes it the listening sockets
+// over a Unix socket (SCM_RIGHTS), so the port is never closed and
+// connections arriving meanwhile just wait in the listen queue. Once the
+// new process says it is serving, the old one stops accepting, answers
+// each connection's next request with Connection: close, hangs up once
+// that response is out, and exits when none are left.
+
+// the new process finds its end of the Unix socket here
+#define HANDOFF_FD_VARIABLE "X9_HANDOFF_FD"
+
+// how long the new binary gets to start up before we give up on it
+#define HANDOFF_READY_TIMEOUT_MS 10000
+
+// A backstop: busy connections end after their next response, idle
+// keep-alive ones at their idle timeout, well before this.
+#define HANDOFF_DRAIN_LIMIT_NS (90 * 1000000000L)
+
+// Old process: exec argv as a new server and hand it the sockets. Returns
+// SUCCESS once it is serving; on FAIL we still own the port and carry on.
+int handoff_start(char *argv[], int *sockets, int count);
+
+// New process: if we were started by handoff_start(), fills sockets (room
+// for max) with the inherited listening sockets and sets *count to how
+// many; *count is 0 if we weren't. Returns FAIL if the handoff broke.
+int handoff_receive(int *sockets, int max, int *count);
+
+// New process: tell the old one we're about to serve, so it stops
+// accepting. No-op if we weren't started by a handoff.
+void handoff_ready(void);
+
+#endif
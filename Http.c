@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "AccessLog.h"
+#include "Decimal.h"
+#include "Http.h"
+#include "Latency.h"
+#include "Metrics.h"
+#include "PerfectRouter.h"
+#include "Server.h"
+#include "StaticCache.h"
+#include "Ticker.h"
+
+// big enough for every metric /metrics reports, and small enough to come
+// out of the connection's arena chunk rather than a malloc of its own
+#define METRICS_BODY_SIZE ARENA_CHUNK_CAPACITY
+#define LATENCY_BODY_SIZE 2048
+// "Sum of " and two ints, " and ", " is ", a long and ".\n"
+#define PLUS_BODY_SIZE 64
+
+// Blocks until a whole request is buffered; whatever arrives after it
+// (a pipelined request, say) stays buffered for the next call.
+// *request_ptr points into the client's buffer and is good until
+// client_finish_request(). Returns FAIL, CONNECTION_CLOSED or SUCCESS.
+int read_http_request(Client *cl, char **request_ptr, int *length) {
+  while (1) {
+    int result =
+        client_next_request(cl, request_ptr, length, MAX_MESSAGE_LENGTH);
+    if (result == FAIL) {
+      // can't tell where this request ends; say so and hang up
+      metrics_count(METRIC_MALFORMED_REQUESTS);
+      send_malformed_response(cl);
+      client_flush_output(cl);
+      return FAIL;
+    }
+    if (result != REQUEST_INCOMPLETE)
+      return result;
+
+    // answers to everything pipelined so far go out before we block
+    if (client_flush_output(cl) == FAIL)
+      return FAIL;
+
+    result = client_read_input(cl, MAX_MESSAGE_LENGTH);
+
+    if (result == CONNECTION_CLOSED) {
+      // client side closed connection
+      if (debug)
+        fputs("Client closed connection\n", stderr);
+      return CONNECTION_CLOSED;
+    }
+    if (result == FAIL)
+      return FAIL;
+  }
+}
+
+// For the non-blocking modes: answer every complete request buffered so
+// far, in order, and leave any partial one for when more bytes arrive.
+// Stops early while the client's output is backed up. Returns FAIL when
+// the connection should be dropped, and CONNECTION_CLOSED once its last
+// response (Connection: close) is out of the way.
+int serve_buffered_requests(Client *cl) {
+  while (!client_output_blocked(cl)) {
+    char *request;
+    int length;
+    int result = client_next_request(cl, &request, &length, MAX_MESSAGE_LENGTH);
+
+    if (result == REQUEST_INCOMPLETE)
+      return SUCCESS;
+    if (result == FAIL) {
+      metrics_count(METRIC_MALFORMED_REQUESTS);
+      send_malformed_response(cl);
+      return FAIL;
+    }
+
+    result = respond_to_http_request(cl, request);
+    client_finish_request(cl);
+    if (result == FAIL)
+      return FAIL;
+    if (cl->close_after_response)
+      return CONNECTION_CLOSED;
+  }
+  return SUCCESS;
+}
+
+// appends length bytes of text at out; returns the new end
+static char *append(char *out, const char *text, int length) {
+  memcpy(out, text, length);
+  return out + length;
+}
+
+// every generated header starts with these, the Date line in between
+static const char status_line[] = "HTTP/1.1 200\r\n";
+static const char before_length[] = "Content-type: text/plain\r\n"
+                                    "Content-Length: ";
+
+// Header block for a 200 carrying content_length body bytes; closing
+// says Connection: close. Returns the header's length, or FAIL if it
+// won't fit in size.
+int format_http_header(char *header, int size, long content_length,
+                       int closing) {
+  static const char after_length[] = "\r\n"
+                                     "Connection: Keep-Alive\r\n"
+                                     "\r\n";
+  static const char after_length_closing[] = "\r\n"
+                                             "Connection: close\r\n"
+                                             "\r\n";
+
+  if (size < (int)(sizeof(status_line) + sizeof(before_length) +
+                   sizeof(after_length_closing)) -
+                 3 + TICKER_DATE_LINE_LENGTH + DECIMAL_MAX_LENGTH)
+    return FAIL;
+
+  char *out = append(header, status_line, sizeof(status_line) - 1);
+  out += ticker_date_line(out);
+  out = append(out, before_length, sizeof(before_length) - 1);
+  out += decimal_format(content_length, out);
+  if (closing)
+    out = append(out, after_length_closing, sizeof(after_length_closing) - 1);
+  else
+    out = append(out, after_length, sizeof(after_length) - 1);
+  return out - header;
+}
+
+// Header and body go out together in one writev(); the body is never
+// copied and may hold any bytes, NULs included.
+int send_http_response(Client *cl, const char *body, int body_length) {
+  char header[MAX_GENERATED_LENGTH];
+  cl->response_status = 200;
+  int header_length = format_http_header(header, sizeof(header), body_length,
+                                         cl->close_after_response);
+
+  struct iovec segments[2] = {
+      {.iov_base = header, .iov_len = header_length},
+      {.iov_base = (void *)body, .iov_len = body_length},
+  };
+  return client_writev(cl, segments, 2);
+}
+
+// Header block, then the file straight from the page cache - the body
+// never passes through our memory, and binary files go out intact.
+int send_http_file_response(Client *cl, int file_fd, long size) {
+  char header[MAX_GENERATED_LENGTH];
+  cl->response_status = 200;
+  int header_length = format_http_header(header, sizeof(header), size,
+                                         cl->close_after_response);
+
+  if (client_write_length(cl, header, header_length) == FAIL)
+    return FAIL;
+
+  return client_sendfile(cl, file_fd, size);
+}
+
+// body straight out of a cached mapping
+int send_http_cached_response(Client *cl, Cached_file *file) {
+  return send_http_response(cl, file->data, file->size);
+}
+
+// Fixed replies, serialized once by http_init(). Only the Date line
+// changes; it goes in at date_offset and the whole reply is sent with a
+// single writev().
+typedef struct {
+  char *data;
+  int length;
+  int date_offset;
+} Canned_response;
+
+#define CANNED_INVALID 0
+#define CANNED_MALFORMED 1 // framing we can't follow; we hang up after it
+#define CANNED_NONEXISTENT 2
+#define CANNED_COUNT 3
+
+Canned_response canned_responses[CANNED_COUNT];
+// the same with Connection: close, for a connection's last response
+Canned_response canned_closing_responses[CANNED_COUNT];
+
+int build_canned_response(Canned_response *canned, const char *connection,
+                          const char *body) {
+  int body_length = strlen(body);
+  char *data = malloc(sizeof(status_line) + sizeof(before_length) +
+                      DECIMAL_MAX_LENGTH + strlen(connection) + 32 +
+                      body_length);
+  if (!data) {
+    perror("malloc canned response");
+    return FAIL;
+  }
+
+  char *out = append(data, status_line, sizeof(status_line) - 1);
+  canned->date_offset = out - data;
+  out = append(out, before_length, sizeof(before_length) - 1);
+  out += decimal_format(body_length, out);
+  out = append(out, "\r\nConnection: ", 14);
+  out = append(out, connection, strlen(connection));
+  out = append(out, "\r\n\r\n", 4);
+  out = append(out, body, body_length);
+
+  canned->data = data;
+  canned->length = out - data;
+  return SUCCESS;
+}
+
+int send_canned_response(Client *cl, int index) {
+  Canned_response *canned = cl->close_after_response
+                                ? &canned_closing_responses[index]
+                                : &canned_responses[index];
+  char date_line[TICKER_DATE_LINE_LENGTH];
+  ticker_date_line(date_line);
+
+  cl->response_status = 200;
+  struct iovec segments[3] = {
+      {.iov_base = canned->data, .iov_len = canned->date_offset},
+      {.iov_base = date_line, .iov_len = TICKER_DATE_LINE_LENGTH},
+      {.iov_base = canned->data + canned->date_offset,
+       .iov_len = canned->length - canned->date_offset},
+  };
+  return client_writev(cl, segments, 3);
+}
+
+int send_error_response(Client *cl) {
+  return send_canned_response(cl, CANNED_INVALID);
+}
+
+int send_malformed_response(Client *cl) {
+  return send_canned_response(cl, CANNED_MALFORMED);
+}
+
+int send_nonexistent_response(Client *cl) {
+  return send_canned_response(cl, CANNED_NONEXISTENT);
+}
+
+long elapsed_ns(struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000000000L +
+         (now.tv_nsec - since->tv_nsec);
+}
+
+// Answers one request and, when the access log is on, logs it - timed
+// from dispatch until the response was handed to the connection. Its
+// latency is recorded when the response has gone out.
+int respond_to_http_request(Client *cl, char *request) {
+  int logging = access_log_enabled();
+  struct timespec start;
+  if (logging)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+  cl->response_status = 0;
+  cl->response_bytes = 0;
+  // upgrading: finish this one and let the client reconnect to the new
+  // process
+  if (__atomic_load_n(&draining, __ATOMIC_ACQUIRE))
+    cl->close_after_response = 1;
+  int route;
+  int result = route_http_request(cl, request, &route);
+  metrics_count(METRIC_REQUESTS + route);
+  client_response_queued(cl, route);
+
+  if (logging)
+    access_log_record(request, cl->response_status, cl->response_bytes,
+                      elapsed_ns(&start), client_id(cl));
+  return result;
+}
+
+// The built-in routes are the ones in routes.list; anything else
+// registered with router_add() is served the same way (by the trie).
+int http_init(void) {
+  static const char invalid_body[] = "Invalid request.\n"
+                                     "\n"
+                                     "Not found.\n";
+
+  static const char nonexistent_body[] = "Nonexistent resource\n";
+
+  if (build_canned_response(&canned_responses[CANNED_INVALID], "Keep-Alive",
+                            invalid_body) == FAIL ||
+      build_canned_response(&canned_responses[CANNED_MALFORMED], "close",
+                            invalid_body) == FAIL ||
+      build_canned_response(&canned_responses[CANNED_NONEXISTENT],
+                            "Keep-Alive", nonexistent_body) == FAIL)
+    return FAIL;
+
+  for (int i = 0; i < CANNED_COUNT; i++)
+    if (build_canned_response(&canned_closing_responses[i], "close",
+                              i == CANNED_NONEXISTENT ? nonexistent_body
+                                                      : invalid_body) ==
+        FAIL)
+      return FAIL;
+
+  return perfect_router_register();
+}
+
+// Cheap look at the request line: a method token of capitals, one space
+// and a path starting with '/'. Scanners' garbage fails this and gets the
+// canned error without going near the router.
+int request_line_plausible(const char *text) {
+  int i = 0;
+  while (i < ROUTER_MAX_METHOD_LENGTH && text[i] >= 'A' && text[i] <= 'Z')
+    i++;
+  return i > 0 && text[i] == ' ' && text[i + 1] == '/';
+}
+
+// *route is the id of the route that took the request
+int route_http_request(Client *cl, char *text, int *route) {
+  Http_request request;
+  Route_handler handler = NULL;
+
+  *route = ROUTE_NOT_FOUND;
+  if (!request_line_plausible(text)) {
+    send_error_response(cl);
+    return SUCCESS;
+  }
+
+  if (router_parse_request(text, &request) != FAIL)
+#ifdef PERFECT_ROUTES
+    *route = perfect_router_find(&request, &handler);
+#else
+    *route = router_find(&request, &handler);
+#endif
+
+  if (!handler) {
+    send_error_response(cl);
+    return SUCCESS;
+  }
+  return handler(cl, &request);
+}
+
+// path parameter index as an int; FAIL if it isn't one
+int int_param(Http_request *request, int index, int *value) {
+  long parsed;
+  if (decimal_parse_signed(request->params[index],
+                           request->param_lengths[index], INT_MIN, INT_MAX,
+                           &parsed) == FAIL)
+    return FAIL;
+
+  *value = parsed;
+  return SUCCESS;
+}
+
+int handle_math_request(Client *cl, Http_request *request) {
+  int num1;
+  int num2;
+
+  if (int_param(request, 0, &num1) == FAIL ||
+      int_param(request, 1, &num2) == FAIL) {
+    send_error_response(cl);
+    return SUCCESS;
+  }
+
+  // "Sum of %d and %d is %ld.\n", built by hand; the sum is taken as a
+  // long so two large ints can't wrap
+  char response_body[PLUS_BODY_SIZE];
+  char *out = response_body;
+  out = append(out, "Sum of ", 7);
+  out += decimal_format(num1, out);
+  out = append(out, " and ", 5);
+  out += decimal_format(num2, out);
+  out = append(out, " is ", 4);
+  out += decimal_format((long)num1 + num2, out);
+  out = append(out, ".\n", 2);
+
+  return send_http_response(cl, response_body, out - response_body);
+}
+
+// value of hex digit c, or -1
+int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// Decodes the %XX escapes in path[0..length) into out (room for length
+// + 1), NUL-terminated. FAIL for a broken escape, for %00 and %2F (a NUL
+// or a '/' that wasn't one in the URL) and for a ".." segment, which
+// would lead out of the directory we serve.
+int decode_path(const char *path, int length, char *out) {
+  int out_length = 0;
+  for (int i = 0; i < length; i++) {
+    char c = path[i];
+    if (c == '%') {
+      int high = i + 2 < length ? hex_value(path[i + 1]) : -1;
+      int low = high != -1 ? hex_value(path[i + 2]) : -1;
+      if (low == -1)
+        return FAIL;
+      c = high << 4 | low;
+      if (c == '\0' || c == '/')
+        return FAIL;
+      i += 2;
+    }
+    out[out_length++] = c;
+  }
+  out[out_length] = '\0';
+
+  for (char *segment = out; segment; segment = strchr(segment, '/')) {
+    if (*segment == '/')
+      segment++;
+    if (segment[0] == '.' && segment[1] == '.' &&
+        (segment[2] == '/' || segment[2] == '\0'))
+      return FAIL;
+  }
+  return SUCCESS;
+}
+
+int handle_static_request(Client *cl, Http_request *request) {
+  int length = request->param_lengths[0];
+  char *file_path = client_scratch(cl, length + 1);
+  if (!file_path)
+    return FAIL;
+  if (decode_path(request->params[0], length, file_path) == FAIL) {
+    send_error_response(cl);
+    return SUCCESS;
+  }
+  int result;
+
+  if (static_cache_enabled()) {
+    Cached_file *cached;
+    result = static_cache_get(file_path, &cached);
+
+    if (result == SUCCESS) {
+      result = send_http_cached_response(cl, cached);
+      static_cache_release(cached);
+      return result;
+    }
+    if (result == NONEXISTENT_FILE)
+      return send_nonexistent_response(cl);
+    // too big to map (or trouble mapping it): serve it from disk
+  }
+
+  int file_fd;
+  long size;
+  result = open_file_contents(file_path, &file_fd, &size);
+
+  if (result == FAIL)
+    return FAIL;
+  if (result == NONEXISTENT_FILE) {
+    return send_nonexistent_response(cl);
+  }
+
+  result = send_http_file_response(cl, file_fd, size);
+  close(file_fd);
+  return result;
+}
+
+// Prometheus text format; the counters are summed across threads here,
+// never on the paths that record them.
+int handle_metrics_request(Client *cl, Http_request *request) {
+  char *body = client_scratch(cl, METRICS_BODY_SIZE);
+  if (!body)
+    return FAIL;
+  int body_length = metrics_format(body, METRICS_BODY_SIZE);
+
+  if (body_length == FAIL) {
+    fputs("metrics don't fit METRICS_BODY_SIZE\n", stderr);
+    send_error_response(cl);
+    return SUCCESS;
+  }
+
+  return send_http_response(cl, body, body_length);
+}
+
+// per-route latency percentiles, merged across threads
+int handle_latency_request(Client *cl, Http_request *request) {
+  char *body = client_scratch(cl, LATENCY_BODY_SIZE);
+  if (!body)
+    return FAIL;
+  int body_length = latency_format(body, LATENCY_BODY_SIZE);
+
+  if (body_length == FAIL) {
+    fputs("latencies don't fit LATENCY_BODY_SIZE\n", stderr);
+    send_error_response(cl);
+    return SUCCESS;
+  }
+
+  return send_http_response(cl, body, body_length);
+}
+
+// this returns FAIL (system error - close connection), SUCCESS,
+// or NONEXISTENT_FILE. On SUCCESS the caller closes *file_fd.
+int open_file_contents(const char *file_path, int *file_fd, long *size) {
+  int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+
+  if (fd == -1) {
+    return NONEXISTENT_FILE;
+  }
+
+  struct stat file_info;
+  if (fstat(fd, &file_info) == -1) {
+    fprintf(stderr, "unable to stat file '%s'.\n", file_path);
+    close(fd);
+    return FAIL;
+  }
+
+  // directories and the like aren't resources we serve
+  if (!S_ISREG(file_info.st_mode)) {
+    close(fd);
+    return NONEXISTENT_FILE;
+  }
+
+  *file_fd = fd;
+  *size = file_info.st_size;
+  return SUCCESS;
+}
@@ -0,0 +1,39 @@
+#include "Client.h"
+#include "Router.h"
+#include "StaticCache.h"
+
+#ifndef HTTP_H
+#define HTTP_H
+
+// Request handling shared by every serving mode: reading a request off a
+// client, routing it, and writing the response back through the Client.
+// main() and the loops only move bytes; everything HTTP lives here.
+
+#define MAX_GENERATED_LENGTH 1024
+
+// registers the built-in routes and builds the canned responses; call
+// once before serving
+int http_init(void);
+
+//! All return FAIL (0). Anything else is successey
+int read_http_request(Client *cl, char **request_ptr, int *length);
+int format_http_header(char *header, int size, long content_length,
+                       int closing);
+int send_error_response(Client *cl);
+// the error, with Connection: close, for requests we can't frame
+int send_malformed_response(Client *cl);
+int send_nonexistent_response(Client *cl);
+int send_http_response(Client *cl, const char *body, int body_length);
+int send_http_file_response(Client *cl, int file_fd, long size);
+int send_http_cached_response(Client *cl, Cached_file *file);
+int route_http_request(Client *cl, char *request, int *route);
+int handle_math_request(Client *cl, Http_request *request);
+int handle_static_request(Client *cl, Http_request *request);
+int handle_metrics_request(Client *cl, Http_request *request);
+int handle_latency_request(Client *cl, Http_request *request);
+
+// this returns FAIL (system error - close connection), SUCCESS,
+// or NONEXISTENT_FILE
+int open_file_contents(const char *file_path, int *file_fd, long *size);
+
+#endif
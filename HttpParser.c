@@ -0,0 +1,100 @@
+#include <string.h>
+#include <strings.h>
+
+#include "Client.h"
+#include "Decimal.h"
+#include "HttpParser.h"
+
+void http_parser_reset(Http_parser *p) {
+  p->state = PARSE_HEADERS;
+  p->scanned = 0;
+  p->skip = 0;
+  p->line_ends = 0;
+  p->header_length = 0;
+  p->content_length = 0;
+}
+
+// value of the header starting at line (up to end), or NULL
+const char *header_value(const char *line, const char *end, const char *name) {
+  int name_length = strlen(name);
+  if (end - line <= name_length || strncasecmp(line, name, name_length) ||
+      line[name_length] != ':')
+    return NULL;
+
+  const char *value = line + name_length + 1;
+  while (value < end && (*value == ' ' || *value == '\t'))
+    value++;
+  return value;
+}
+
+// Looks through the complete header block for the framing headers.
+// Returns FAIL for a body we can't frame (bad length, chunked uploads).
+int parse_framing_headers(Http_parser *p, const char *buf, long max_body) {
+  const char *end = buf + p->header_length;
+  const char *start = buf + p->skip;
+  const char *line = memchr(start, '\n', end - start); // skip the request line
+
+  while (line && ++line < end) {
+    const char *line_end = memchr(line, '\n', end - line);
+    if (!line_end)
+      line_end = end;
+
+    const char *value = header_value(line, line_end, "Content-Length");
+    if (value) {
+      const char *value_end = line_end;
+      while (value_end > value && (value_end[-1] == ' ' ||
+                                   value_end[-1] == '\t' ||
+                                   value_end[-1] == '\r'))
+        value_end--;
+      unsigned long length;
+      if (decimal_parse_unsigned(value, value_end - value, max_body,
+                                 &length) == FAIL)
+        return FAIL;
+      p->content_length = length;
+    }
+
+    value = header_value(line, line_end, "Transfer-Encoding");
+    if (value && strncasecmp(value, "identity", 8))
+      return FAIL;
+
+    line = line_end;
+  }
+
+  return SUCCESS;
+}
+
+int http_parser_feed(Http_parser *p, const char *buf, int length,
+                     int max_length, int *request_length) {
+  if (p->state == PARSE_HEADERS) {
+    for (; p->scanned < length; p->scanned++) {
+      char c = buf[p->scanned];
+
+      if (p->scanned == p->skip && (c == '\r' || c == '\n')) {
+        p->skip++; // tolerated before a request line
+        continue;
+      }
+
+      if (c == '\n') {
+        if (++p->line_ends == 2)
+          break;
+      } else if (c != '\r') {
+        p->line_ends = 0;
+      }
+    }
+
+    if (p->line_ends < 2) {
+      return p->scanned >= max_length ? FAIL : REQUEST_INCOMPLETE;
+    }
+
+    p->header_length = ++p->scanned;
+    if (parse_framing_headers(p, buf, max_length - p->header_length) == FAIL)
+      return FAIL;
+    p->state = PARSE_BODY;
+  }
+
+  if (length - p->header_length < p->content_length)
+    return REQUEST_INCOMPLETE;
+
+  *request_length = p->header_length + p->content_length;
+  return SUCCESS;
+}
@@ -0,0 +1,32 @@
+#ifndef HTTPPARSER_H
+#define HTTPPARSER_H
+
+// Resumable request framing: finds where one HTTP/1.1 request (headers
+// plus Content-Length body) ends, however the bytes were split across
+// reads. Only the framing is parsed; handlers still look at the text.
+
+// alongside FAIL/SUCCESS from Client.h: need more bytes
+#define REQUEST_INCOMPLETE 4
+
+#define PARSE_HEADERS 0
+#define PARSE_BODY 1
+
+typedef struct {
+  int state;
+  int scanned;        // bytes already looked at, so we resume where we were
+  int skip;           // stray CR/LF before the request line
+  int line_ends;      // consecutive line ends seen (CR ignored)
+  int header_length;  // through the blank line, once seen
+  long content_length;
+} Http_parser;
+
+void http_parser_reset(Http_parser *p);
+
+// buf/length is everything buffered from the start of the current
+// request. Returns REQUEST_INCOMPLETE, FAIL for something we can't frame,
+// or SUCCESS with *request_length = bytes up to the end of this request
+// (including p->skip leading bytes). Anything past that is the next one.
+int http_parser_feed(Http_parser *p, const char *buf, int length,
+                     int max_length, int *request_length);
+
+#endif
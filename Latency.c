@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Latency.h"
+#include "Metrics.h"
+
+// routes are all registered before the first request, so each thread
+// sizes its histograms for router_route_count() routes
+typedef struct Thread_latencies {
+  struct Thread_latencies *next;
+  int route_count;
+  long max[ROUTER_MAX_ROUTES];
+  _Alignas(CACHE_LINE_SIZE) long counts[][LATENCY_BUCKETS];
+} Thread_latencies;
+
+typedef struct {
+  long counts[LATENCY_BUCKETS];
+  long total;
+  long max;
+} Histogram;
+
+__thread Thread_latencies *thread_latencies = NULL;
+// every thread's histograms; only ever pushed onto
+Thread_latencies *all_thread_latencies = NULL;
+
+Thread_latencies *register_thread_latencies(void) {
+  int route_count = router_route_count();
+  size_t size = sizeof(Thread_latencies) +
+                route_count * sizeof(long[LATENCY_BUCKETS]);
+  size = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+
+  Thread_latencies *t = aligned_alloc(CACHE_LINE_SIZE, size);
+  if (!t) {
+    perror("latency histograms");
+    exit(1);
+  }
+  memset(t, 0, size);
+  t->route_count = route_count;
+
+  t->next = __atomic_load_n(&all_thread_latencies, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&all_thread_latencies, &t->next, t, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+
+  thread_latencies = t;
+  return t;
+}
+
+// values below LATENCY_SUB_BUCKETS get a bucket each; above that, each
+// power of two is split into LATENCY_SUB_BUCKETS equal steps
+int bucket_of(long ns) {
+  if (ns < LATENCY_SUB_BUCKETS)
+    return ns < 0 ? 0 : ns;
+  if (ns >= 1L << LATENCY_MAX_BITS)
+    return LATENCY_BUCKETS - 1;
+
+  int shift = 63 - __builtin_clzl(ns) - LATENCY_SUB_BUCKET_BITS;
+  return (shift + 1) * LATENCY_SUB_BUCKETS +
+         (int)((ns >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// the largest value that lands in bucket
+long bucket_upper_bound(int bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS)
+    return bucket;
+
+  int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  long lower = (long)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS)
+               << shift;
+  return lower + (1L << shift) - 1;
+}
+
+void latency_record(int route, long ns) {
+  Thread_latencies *t = thread_latencies;
+  if (!t)
+    t = register_thread_latencies();
+  if (route >= t->route_count)
+    return;
+
+  long *count = &t->counts[route][bucket_of(ns)];
+  __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+  if (ns > t->max[route])
+    __atomic_store_n(&t->max[route], ns, __ATOMIC_RELAXED);
+}
+
+void merge_route(int route, Histogram *merged) {
+  memset(merged, 0, sizeof(Histogram));
+
+  for (Thread_latencies *t =
+           __atomic_load_n(&all_thread_latencies, __ATOMIC_ACQUIRE);
+       t; t = t->next) {
+    if (route >= t->route_count)
+      continue;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+      long count = __atomic_load_n(&t->counts[route][i], __ATOMIC_RELAXED);
+      merged->counts[i] += count;
+      merged->total += count;
+    }
+    long max = __atomic_load_n(&t->max[route], __ATOMIC_RELAXED);
+    if (max > merged->max)
+      merged->max = max;
+  }
+}
+
+// smallest recorded value that at least percent of the samples don't exceed
+long percentile(Histogram *h, double percent) {
+  long wanted = (long)(h->total * percent / 100.0 + 0.999999);
+  if (wanted < 1)
+    wanted = 1;
+
+  long seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= wanted) {
+      long value = bucket_upper_bound(i);
+      return value < h->max ? value : h->max;
+    }
+  }
+  return h->max;
+}
+
+int latency_format(char *buffer, int size) {
+  static const double percents[] = {50, 90, 99, 99.9};
+  static const char *columns[] = {"p50", "p90", "p99", "p99.9"};
+  int count = sizeof(percents) / sizeof(*percents);
+
+  Histogram *merged = malloc(sizeof(Histogram));
+  if (!merged)
+    return FAIL;
+
+  int length = snprintf(buffer, size, "%-10s %10s", "route", "requests");
+  for (int i = 0; i < count; i++)
+    length += snprintf(buffer + length, length < size ? size - length : 0,
+                       " %9s", columns[i]);
+  length += snprintf(buffer + length, length < size ? size - length : 0,
+                     " %9s   (us)\n", "max");
+
+  for (int route = 0; route < router_route_count(); route++) {
+    merge_route(route, merged);
+    length += snprintf(buffer + length, length < size ? size - length : 0,
+                       "%-10s %10ld", router_route_name(route), merged->total);
+    for (int i = 0; i < count; i++)
+      length += snprintf(buffer + length, length < size ? size - length : 0,
+                         " %9.1f",
+                         merged->total ? percentile(merged, percents[i]) / 1000.0
+                                       : 0.0);
+    length += snprintf(buffer + length, length < size ? size - length : 0,
+                       " %9.1f\n", merged->max / 1000.0);
+  }
+
+  free(merged);
+  if (length >= size)
+    return FAIL;
+  return length;
+}
@@ -0,0 +1,34 @@
+#include <time.h>
+
+#include "Http.h"
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+// Per-route (see Router.h) request latency, from the first byte of a request arriving to
+// the last byte of its response going out. Each thread records into its
+// own log-linear (HDR-style) histograms - a power-of-two bucket split into
+// LATENCY_SUB_BUCKETS linear steps, so every value is kept to within ~3%
+// however large. Threads' histograms are merged only when read.
+
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+// values are ns; anything from 2^40 ns (~18 minutes) up lands in the top bucket
+#define LATENCY_MAX_BITS 40
+#define LATENCY_BUCKETS                                                        \
+  ((LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+static inline long latency_now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// lock-free; only touches the calling thread's histograms
+void latency_record(int route, long ns);
+
+// Merged percentiles per route as a text table. Returns the length
+// written, or FAIL if it didn't fit in size.
+int latency_format(char *buffer, int size);
+
+#endif
@@ -0,0 +1,118 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AccessLog.h"
+#include "Metrics.h"
+
+__thread Thread_metrics *thread_metrics = NULL;
+
+// every thread's counters; only ever pushed onto
+Thread_metrics *all_thread_metrics = NULL;
+
+Thread_metrics *metrics_register_thread(void) {
+  // padded to whole cache lines so no two threads' counters share one
+  size_t size = (sizeof(Thread_metrics) + CACHE_LINE_SIZE - 1) /
+                CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+  Thread_metrics *m = aligned_alloc(CACHE_LINE_SIZE, size);
+  if (!m) {
+    perror("metrics_register_thread");
+    exit(1);
+  }
+  memset(m, 0, size);
+
+  m->next = __atomic_load_n(&all_thread_metrics, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&all_thread_metrics, &m->next, m, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+
+  thread_metrics = m;
+  return m;
+}
+
+long metrics_sum(int metric) {
+  long total = 0;
+  for (Thread_metrics *m = __atomic_load_n(&all_thread_metrics, __ATOMIC_ACQUIRE);
+       m; m = m->next)
+    total += __atomic_load_n(&m->counters[metric], __ATOMIC_RELAXED);
+  return total;
+}
+
+long metrics_open_connections(void) {
+  // closes first, as for the gauge below: never less than the truth
+  long closed = metrics_sum(METRIC_CONNECTIONS_CLOSED);
+  long accepted = metrics_sum(METRIC_CONNECTIONS_ACCEPTED);
+  return accepted > closed ? accepted - closed : 0;
+}
+
+typedef struct {
+  char *buffer;
+  int size;
+  int length;
+} Output;
+
+// appends to out; once something doesn't fit, length goes past size
+void append(Output *out, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int room = out->length < out->size ? out->size - out->length : 0;
+  out->length += vsnprintf(out->buffer + out->length, room, format, args);
+  va_end(args);
+}
+
+void append_header(Output *out, const char *name, const char *type,
+                   const char *help) {
+  append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+int metrics_format(char *buffer, int size) {
+  Output out = {.buffer = buffer, .size = size, .length = 0};
+
+  // closes are summed before accepts: a close we count had its accept
+  // happen earlier, so the gauge can't dip below the truth
+  long closed = metrics_sum(METRIC_CONNECTIONS_CLOSED);
+  long accepted = metrics_sum(METRIC_CONNECTIONS_ACCEPTED);
+
+  append_header(&out, "x9_connections_accepted_total", "counter",
+                "Connections accepted.");
+  append(&out, "x9_connections_accepted_total %ld\n", accepted);
+
+  append_header(&out, "x9_active_connections", "gauge",
+                "Connections currently open.");
+  append(&out, "x9_active_connections %ld\n",
+         accepted > closed ? accepted - closed : 0);
+
+  append_header(&out, "x9_requests_total", "counter", "Requests, by route.");
+  for (int route = 0; route < router_route_count(); route++)
+    append(&out, "x9_requests_total{route=\"%s\"} %ld\n",
+           router_route_name(route), metrics_sum(METRIC_REQUESTS + route));
+
+  append_header(&out, "x9_received_bytes_total", "counter",
+                "Bytes read from clients.");
+  append(&out, "x9_received_bytes_total %ld\n", metrics_sum(METRIC_BYTES_IN));
+
+  append_header(&out, "x9_sent_bytes_total", "counter",
+                "Bytes written to clients.");
+  append(&out, "x9_sent_bytes_total %ld\n", metrics_sum(METRIC_BYTES_OUT));
+
+  append_header(&out, "x9_errors_total", "counter",
+                "Requests that couldn't be framed, and failed socket I/O.");
+  append(&out, "x9_errors_total{kind=\"malformed_request\"} %ld\n",
+         metrics_sum(METRIC_MALFORMED_REQUESTS));
+  append(&out, "x9_errors_total{kind=\"io\"} %ld\n",
+         metrics_sum(METRIC_IO_ERRORS));
+
+  append_header(&out, "x9_timeouts_total", "counter",
+                "Connections closed for idling, or for sending a request "
+                "too slowly.");
+  append(&out, "x9_timeouts_total %ld\n", metrics_sum(METRIC_TIMEOUTS));
+
+  append_header(&out, "x9_access_log_dropped_total", "counter",
+                "Access log records dropped because the writer fell behind.");
+  append(&out, "x9_access_log_dropped_total %ld\n", access_log_dropped());
+
+  if (out.length >= size)
+    return FAIL;
+  return out.length;
+}
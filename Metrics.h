@@ -0,0 +1,53 @@
+#include "Http.h"
+
+#ifndef METRICS_H
+#define METRICS_H
+
+// Server counters, kept per thread so recording one is a plain add to a
+// cache line no other thread writes: no lock, no atomic read-modify-write.
+// The per-thread copies are only summed when /metrics is scraped.
+
+#define METRIC_CONNECTIONS_ACCEPTED 0
+#define METRIC_CONNECTIONS_CLOSED 1
+#define METRIC_BYTES_IN 2
+#define METRIC_BYTES_OUT 3
+#define METRIC_MALFORMED_REQUESTS 4 // couldn't be framed
+#define METRIC_IO_ERRORS 5          // a read, write or sendfile failed
+#define METRIC_TIMEOUTS 6           // connections closed by a deadline
+#define METRIC_REQUESTS 7           // + route id
+#define METRIC_COUNT (METRIC_REQUESTS + ROUTER_MAX_ROUTES)
+
+#define CACHE_LINE_SIZE 64
+
+// one per thread that has recorded anything; never freed
+typedef struct Thread_metrics {
+  _Alignas(CACHE_LINE_SIZE) long counters[METRIC_COUNT];
+  struct Thread_metrics *next;
+} Thread_metrics;
+
+extern __thread Thread_metrics *thread_metrics;
+
+// first use on a thread; returns its (zeroed) counters
+Thread_metrics *metrics_register_thread(void);
+
+// Only the owning thread writes its counters; the relaxed store just keeps
+// a concurrent scrape from seeing a torn value.
+static inline void metrics_add(int metric, long amount) {
+  Thread_metrics *m = thread_metrics;
+  if (!m)
+    m = metrics_register_thread();
+  __atomic_store_n(&m->counters[metric], m->counters[metric] + amount,
+                   __ATOMIC_RELAXED);
+}
+
+static inline void metrics_count(int metric) { metrics_add(metric, 1); }
+
+// Connections accepted and not yet closed; may overcount while they
+// change, but is 0 only once none are open.
+long metrics_open_connections(void);
+
+// Sums every thread's counters into Prometheus text format. Returns the
+// length written, or FAIL if it didn't fit in size.
+int metrics_format(char *buffer, int size);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef PERFECTHASH_H
+#define PERFECTHASH_H
+
+// The hash behind the generated route table, shared by tools/routegen
+// (which picks the seeds) and the lookup. A key's bytes are hashed once
+// (FNV-1a); the bucket and the slot are two cheap mixes of that value.
+
+static inline unsigned perfect_hash_add(unsigned hash, const char *bytes,
+                                        int length) {
+  for (int i = 0; i < length; i++)
+    hash = (hash ^ (unsigned char)bytes[i]) * 16777619u;
+  return hash;
+}
+
+static inline unsigned perfect_hash_mix(unsigned hash, unsigned seed) {
+  hash ^= seed * 0x9e3779b9u;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  return hash;
+}
+
+// A route's key is its method and the path up to and including the
+// second '/', or the whole path if there isn't one: "GET /plus/".
+static inline int perfect_key_length(const char *path, int path_length) {
+  for (int i = 1; i < path_length; i++)
+    if (path[i] == '/')
+      return i + 1;
+  return path_length;
+}
+
+static inline unsigned perfect_hash_key(const char *method, int method_length,
+                                        const char *path, int key_length) {
+  unsigned hash = perfect_hash_add(2166136261u, method, method_length);
+  hash = perfect_hash_add(hash, " ", 1);
+  return perfect_hash_add(hash, path, key_length);
+}
+
+// bucket: perfect_hash_mix(key_hash, 0); slot: mixed with the bucket's seed
+
+#endif
@@ -0,0 +1,81 @@
+#include <string.h>
+
+#include "Http.h"
+#include "PerfectHash.h"
+#include "PerfectRouter.h"
+
+#include "PerfectRoutes.h"
+
+int perfect_router_register(void) {
+  for (int i = 0; i < PERFECT_ROUTE_COUNT; i++) {
+    Perfect_route *r = &perfect_routes[perfect_route_order[i]];
+    r->route = router_add(r->method, r->pattern, r->handler, r->name);
+    if (r->route == FAIL)
+      return FAIL;
+  }
+  return SUCCESS;
+}
+
+// Splits what follows the literal into the route's parameters; FAIL if
+// it doesn't have that shape.
+int match_tail(Perfect_route *r, Http_request *request) {
+  const char *p = request->path + r->literal_length;
+  const char *end = request->path + request->path_length;
+
+  for (int i = 0; i < r->params; i++) {
+    const char *segment = p;
+    while (p < end && *p != '/')
+      p++;
+    if (p == segment)
+      return FAIL;
+
+    request->params[i] = segment;
+    request->param_lengths[i] = p - segment;
+
+    // another parameter follows
+    if (i < r->params - 1 || r->wildcard) {
+      if (p == end)
+        return FAIL;
+      p++;
+    }
+  }
+
+  if (r->wildcard) {
+    if (p == end)
+      return FAIL;
+    request->params[r->params] = p;
+    request->param_lengths[r->params] = end - p;
+    request->param_count = r->params + 1;
+    return SUCCESS;
+  }
+
+  request->param_count = r->params;
+  return p == end ? SUCCESS : FAIL;
+}
+
+int perfect_router_find(Http_request *request, Route_handler *handler) {
+  const char *path = request->path;
+  int key_length = perfect_key_length(path, request->path_length);
+
+  unsigned hash = perfect_hash_key(request->method, request->method_length,
+                                   path, key_length);
+  unsigned bucket = perfect_hash_mix(hash, 0) % PERFECT_ROUTE_BUCKETS;
+  Perfect_route *r =
+      &perfect_routes[perfect_hash_mix(hash, perfect_route_seeds[bucket]) %
+                      PERFECT_ROUTE_COUNT];
+
+  request->param_count = 0;
+  *handler = NULL;
+
+  if (r->method_length != request->method_length ||
+      request->path_length < r->literal_length ||
+      memcmp(r->method, request->method, r->method_length) ||
+      memcmp(r->pattern, path, r->literal_length) ||
+      match_tail(r, request) == FAIL) {
+    request->param_count = 0;
+    return ROUTE_NOT_FOUND;
+  }
+
+  *handler = r->handler;
+  return r->route;
+}
@@ -0,0 +1,34 @@
+#include "Router.h"
+
+#ifndef PERFECTROUTER_H
+#define PERFECTROUTER_H
+
+// The routes in routes.list, looked up through a minimal perfect hash that
+// tools/routegen generates at build time (PerfectRoutes.h): hash the
+// method and first path segment, mix that once for a bucket and again
+// with the bucket's seed for a slot, and compare against the one route
+// in that slot. Servers built with
+// -DPERFECT_ROUTES (make main-perfect) route this way instead of walking
+// the trie, so routes added with router_add() alone aren't seen.
+
+typedef struct {
+  const char *method;
+  int method_length;
+  const char *pattern;
+  int literal_length; // pattern bytes before the first parameter
+  int key_length;
+  int params;   // :name segments after the literal
+  int wildcard; // then a *name
+  Route_handler handler;
+  const char *name;
+  int route; // id from router_add()
+} Perfect_route;
+
+// Registers every listed route with router_add(), in list order, so ids
+// and names are the same whichever way requests are routed.
+int perfect_router_register(void);
+
+// same contract as router_find()
+int perfect_router_find(Http_request *request, Route_handler *handler);
+
+#endif
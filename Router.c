@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Router.h"
+
+typedef struct {
+  char method[ROUTER_MAX_METHOD_LENGTH + 1];
+  int route;
+} Route_entry;
+
+typedef struct Route_node {
+  // literal text on the edge into this node; empty for :name and *name
+  char *prefix;
+  int prefix_length;
+
+  // literal children, told apart by their prefix's first byte
+  struct Route_node **children;
+  char *child_firsts;
+  int child_count;
+  struct Route_node *param_child;    // :name
+  struct Route_node *wildcard_child; // *name
+
+  // routes whose pattern ends here, one per method
+  Route_entry *entries;
+  int entry_count;
+} Route_node;
+
+typedef struct {
+  const char *name;
+  Route_handler handler;
+} Route;
+
+Route_node root;
+Route routes[ROUTER_MAX_ROUTES] = {{.name = "not_found", .handler = NULL}};
+int route_count = 1;
+
+Route_node *new_node(const char *prefix, int prefix_length) {
+  Route_node *node = calloc(1, sizeof(Route_node));
+  node->prefix = malloc(prefix_length + 1);
+  memcpy(node->prefix, prefix, prefix_length);
+  node->prefix[prefix_length] = '\0';
+  node->prefix_length = prefix_length;
+  return node;
+}
+
+void add_child(Route_node *parent, Route_node *child) {
+  int count = parent->child_count + 1;
+  parent->children = realloc(parent->children, count * sizeof(Route_node *));
+  parent->child_firsts = realloc(parent->child_firsts, count);
+  parent->children[count - 1] = child;
+  parent->child_firsts[count - 1] = child->prefix[0];
+  parent->child_count = count;
+}
+
+Route_node *find_child(Route_node *node, char first) {
+  for (int i = 0; i < node->child_count; i++)
+    if (node->child_firsts[i] == first)
+      return node->children[i];
+  return NULL;
+}
+
+// Cuts child's edge after keep bytes: a new node takes the first part and
+// child hangs under it with the rest. Returns the new node.
+Route_node *split_child(Route_node *parent, Route_node *child, int keep) {
+  Route_node *middle = new_node(child->prefix, keep);
+
+  memmove(child->prefix, child->prefix + keep, child->prefix_length - keep + 1);
+  child->prefix_length -= keep;
+  add_child(middle, child);
+
+  for (int i = 0; i < parent->child_count; i++)
+    if (parent->children[i] == child)
+      parent->children[i] = middle;
+  return middle;
+}
+
+// follows (making as needed) the literal edges spelling text[0..length)
+Route_node *insert_literal(Route_node *node, const char *text, int length) {
+  while (length > 0) {
+    Route_node *child = find_child(node, text[0]);
+    if (!child) {
+      child = new_node(text, length);
+      add_child(node, child);
+      return child;
+    }
+
+    int common = 0;
+    while (common < length && common < child->prefix_length &&
+           child->prefix[common] == text[common])
+      common++;
+
+    if (common < child->prefix_length)
+      child = split_child(node, child, common);
+
+    node = child;
+    text += common;
+    length -= common;
+  }
+  return node;
+}
+
+int router_add(const char *method, const char *pattern, Route_handler handler,
+               const char *name) {
+  if (route_count == ROUTER_MAX_ROUTES || pattern[0] != '/' ||
+      strlen(method) > ROUTER_MAX_METHOD_LENGTH) {
+    fprintf(stderr, "can't route %s %s\n", method, pattern);
+    return FAIL;
+  }
+
+  Route_node *node = &root;
+  int params = 0;
+  const char *p = pattern;
+
+  while (*p) {
+    if (*p == ':' || *p == '*') {
+      int wildcard = *p == '*';
+      const char *end = p + 1;
+      while (*end && *end != '/')
+        end++;
+
+      if (++params > ROUTER_MAX_PARAMS || (wildcard && *end)) {
+        fprintf(stderr, "can't route %s %s\n", method, pattern);
+        return FAIL;
+      }
+
+      Route_node **slot = wildcard ? &node->wildcard_child : &node->param_child;
+      if (!*slot)
+        *slot = new_node("", 0);
+      node = *slot;
+      p = end;
+      continue;
+    }
+
+    int length = strcspn(p, ":*");
+    node = insert_literal(node, p, length);
+    p += length;
+  }
+
+  for (int i = 0; i < node->entry_count; i++)
+    if (!strcmp(node->entries[i].method, method)) {
+      fprintf(stderr, "%s %s is already routed\n", method, pattern);
+      return FAIL;
+    }
+
+  node->entries =
+      realloc(node->entries, (node->entry_count + 1) * sizeof(Route_entry));
+  Route_entry *entry = &node->entries[node->entry_count++];
+  strcpy(entry->method, method);
+  entry->route = route_count;
+
+  routes[route_count].name = name;
+  routes[route_count].handler = handler;
+  return route_count++;
+}
+
+int router_parse_request(char *text, Http_request *request) {
+  request->text = text;
+  request->param_count = 0;
+
+  const char *space = strchr(text, ' ');
+  if (!space || space == text)
+    return FAIL;
+  request->method = text;
+  request->method_length = space - text;
+
+  request->path = space + 1;
+  request->path_length = strcspn(request->path, " ?#\r\n");
+  return request->path_length > 0 ? SUCCESS : FAIL;
+}
+
+// the route for request's method among the ones ending at node, or -1
+int entry_for_method(Route_node *node, Http_request *request) {
+  for (int i = 0; i < node->entry_count; i++) {
+    Route_entry *entry = &node->entries[i];
+    if ((int)strlen(entry->method) == request->method_length &&
+        !memcmp(entry->method, request->method, request->method_length))
+      return entry->route;
+  }
+  return -1;
+}
+
+// Matches path[0..length) below node, recording parameters as it goes
+// and backing out of the ones on branches that don't pan out.
+int match(Route_node *node, const char *path, int length,
+          Http_request *request) {
+  if (length == 0)
+    return entry_for_method(node, request);
+
+  Route_node *child = find_child(node, path[0]);
+  if (child && child->prefix_length <= length &&
+      !memcmp(child->prefix, path, child->prefix_length)) {
+    int route = match(child, path + child->prefix_length,
+                      length - child->prefix_length, request);
+    if (route != -1)
+      return route;
+  }
+
+  int count = request->param_count;
+  if (count == ROUTER_MAX_PARAMS)
+    return -1;
+
+  if (node->param_child) {
+    int segment = 0;
+    while (segment < length && path[segment] != '/')
+      segment++;
+
+    if (segment > 0) {
+      request->params[count] = path;
+      request->param_lengths[count] = segment;
+      request->param_count = count + 1;
+
+      int route =
+          match(node->param_child, path + segment, length - segment, request);
+      if (route != -1)
+        return route;
+      request->param_count = count;
+    }
+  }
+
+  if (node->wildcard_child) {
+    int route = entry_for_method(node->wildcard_child, request);
+    if (route != -1) {
+      request->params[count] = path;
+      request->param_lengths[count] = length;
+      request->param_count = count + 1;
+      return route;
+    }
+  }
+
+  return -1;
+}
+
+int router_find(Http_request *request, Route_handler *handler) {
+  request->param_count = 0;
+  int route = match(&root, request->path, request->path_length, request);
+
+  if (route == -1) {
+    request->param_count = 0;
+    *handler = NULL;
+    return ROUTE_NOT_FOUND;
+  }
+
+  *handler = routes[route].handler;
+  return route;
+}
+
+int router_route_count(void) { return route_count; }
+
+const char *router_route_name(int route) { return routes[route].name; }
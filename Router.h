@@ -0,0 +1,56 @@
+#include "Client.h"
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+// Route table: handlers are registered for a method and a path pattern,
+// and found with a walk of a compact radix trie - the cost grows with the
+// length of the path, not the number of routes.
+//
+// Patterns are literal text plus
+//   :name  one path segment (no '/'), handed to the handler as a parameter
+//   *name  the rest of the path (at least one byte), also a parameter
+// e.g. "/plus/:a/:b" or "/static/*path". Literal text wins over :name,
+// which wins over *name. Routes are registered at startup, before any
+// serving thread runs; lookups never change the table.
+
+#define ROUTER_MAX_ROUTES 16
+#define ROUTER_MAX_PARAMS 8
+// longest method a route can be registered for; request_line_plausible()
+// turns away longer ones before they get here
+#define ROUTER_MAX_METHOD_LENGTH 15
+// route id router_find() gives requests nothing matched
+#define ROUTE_NOT_FOUND 0
+
+// A request as the router sees it; everything points into text.
+typedef struct {
+  char *text; // the whole request, NUL-terminated
+  const char *method;
+  int method_length;
+  const char *path; // without any query string
+  int path_length;
+  int param_count;
+  const char *params[ROUTER_MAX_PARAMS]; // in pattern order
+  int param_lengths[ROUTER_MAX_PARAMS];
+} Http_request;
+
+// Returns FAIL to have the connection dropped, like the other handlers.
+typedef int (*Route_handler)(Client *cl, Http_request *request);
+
+// name labels the route in metrics. Returns the route's id, or FAIL for
+// a pattern we can't take (or a full table).
+int router_add(const char *method, const char *pattern, Route_handler handler,
+               const char *name);
+
+// Splits the request line of text into request. FAIL if there isn't one.
+int router_parse_request(char *text, Http_request *request);
+
+// Fills in request's params and *handler; returns the route id, or
+// ROUTE_NOT_FOUND (with *handler NULL).
+int router_find(Http_request *request, Route_handler *handler);
+
+// ids run from ROUTE_NOT_FOUND up to router_route_count() - 1
+int router_route_count(void);
+const char *router_route_name(int route);
+
+#endif
@@ -0,0 +1,41 @@
+#include "Client.h"
+
+#ifndef SERVER_H
+#define SERVER_H
+
+// Server-wide settings and the request entry points shared by the
+// different ways of serving connections (thread-per-client, epoll, ...)
+
+extern int debug;
+
+// how connections get serviced; picked at startup with -m
+#define IO_MODE_THREADS 0
+#define IO_MODE_EPOLL 1
+#define IO_MODE_URING 2
+
+extern int io_mode;
+extern int loop_thread_count;
+extern int worker_count;
+
+// -l: SO_REUSEPORT shards, each with its own accept/event loop
+#define MAX_LISTENERS 256
+#define PENDING_CONNECTIONS_QUEUE_LENGTH 512
+extern int listener_count;
+extern int listen_backlog;
+
+// Set once SIGUSR2 has handed the listening sockets to a new binary (see
+// Handoff.h). Every accept loop then stops accepting and counts itself
+// out of accepting_loops; both are read and written with __atomic.
+extern int draining;
+extern int accepting_loops;
+
+// no-op unless listeners are sharded
+void pin_thread_to_cpu(int loop_index);
+
+#define MAX_MESSAGE_LENGTH (10 * 1024 * 1024)
+
+//! All return FAIL (0). Anything else is successey
+int respond_to_http_request(Client *cl, char *request);
+int serve_buffered_requests(Client *cl);
+
+#endif
@@ -0,0 +1,421 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Server.h"
+#include "StaticCache.h"
+
+#define CACHE_BUCKETS 1024 // power of two
+#define MAX_WATCHED_DIRECTORIES 256
+#define WATCH_EVENTS                                                           \
+  (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |            \
+   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// everything below is guarded by cache_lock
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+Cached_file *buckets[CACHE_BUCKETS];
+Cached_file *newest = NULL;
+Cached_file *oldest = NULL;
+long cache_budget = 0;
+long cache_bytes = 0;
+
+// inotify watch descriptor -> directory it covers
+typedef struct {
+  int watch;
+  char *directory;
+  long changes; // events seen so far, for load() to spot one racing it
+} Watched_directory;
+
+Watched_directory watched[MAX_WATCHED_DIRECTORIES];
+int watched_count = 0;
+int inotify_fd = -1;
+
+void *static_cache_watch_threadfunc(void *);
+
+// "./a//b" and "a/b" are the same file as far as the cache is concerned
+void normalize_path(const char *path, char *out, int out_size) {
+  int length = 0;
+  while (path[0] == '.' && path[1] == '/')
+    path += 2;
+
+  for (; *path && length < out_size - 1; path++) {
+    if (*path == '/' && length > 0 && out[length - 1] == '/')
+      continue;
+    out[length++] = *path;
+  }
+  out[length] = '\0';
+}
+
+unsigned hash_path(const char *path) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (; *path; path++)
+    hash = (hash ^ (unsigned char)*path) * 16777619u;
+  return hash & (CACHE_BUCKETS - 1);
+}
+
+int static_cache_init(long budget_bytes) {
+  cache_budget = budget_bytes;
+  if (budget_bytes <= 0)
+    return SUCCESS;
+
+  // a mapped file can be truncated while a response copies from it
+  client_catch_copy_faults();
+
+  inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (inotify_fd == -1) {
+    perror("inotify_init1");
+    cache_budget = 0;
+    return FAIL;
+  }
+
+  pthread_t watcher;
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  int result = pthread_create(&watcher, &attributes,
+                              static_cache_watch_threadfunc, NULL);
+  pthread_attr_destroy(&attributes);
+
+  if (result != 0) {
+    errno = result;
+    perror("pthread_create cache watcher");
+    cache_budget = 0;
+    return FAIL;
+  }
+
+  return SUCCESS;
+}
+
+int static_cache_enabled(void) {
+  return __atomic_load_n(&cache_budget, __ATOMIC_RELAXED) > 0;
+}
+
+// caller holds cache_lock
+void unmap_if_unused(Cached_file *entry) {
+  if (--entry->references > 0)
+    return;
+
+  if (entry->data)
+    munmap(entry->data, entry->size);
+  free(entry->path);
+  free(entry);
+}
+
+// caller holds cache_lock
+void lru_unlink(Cached_file *entry) {
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    newest = entry->older;
+
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    oldest = entry->newer;
+
+  entry->newer = entry->older = NULL;
+}
+
+// caller holds cache_lock
+void lru_push_newest(Cached_file *entry) {
+  entry->older = newest;
+  entry->newer = NULL;
+  if (newest)
+    newest->newer = entry;
+  newest = entry;
+  if (!oldest)
+    oldest = entry;
+}
+
+// Takes an entry out of the cache; responses still using it keep the
+// mapping alive until they release it. Caller holds cache_lock.
+void evict(Cached_file *entry) {
+  Cached_file **link = &buckets[hash_path(entry->path)];
+  while (*link && *link != entry)
+    link = &(*link)->next_in_bucket;
+  if (*link)
+    *link = entry->next_in_bucket;
+
+  lru_unlink(entry);
+  cache_bytes -= entry->size;
+
+  if (debug)
+    fprintf(stderr, "static cache: dropped %s\n", entry->path);
+
+  unmap_if_unused(entry);
+}
+
+// the change count of the directory behind watch, or -1 if it's no longer
+// watched. Caller holds cache_lock.
+long directory_changes(int watch) {
+  for (int i = 0; i < watched_count; i++)
+    if (watched[i].watch == watch)
+      return watched[i].changes;
+  return -1;
+}
+
+// caller holds cache_lock
+Cached_file *find(const char *path) {
+  Cached_file *entry = buckets[hash_path(path)];
+  while (entry && strcmp(entry->path, path))
+    entry = entry->next_in_bucket;
+  return entry;
+}
+
+// Watches the directory path lives in (the file itself can be replaced by
+// a rename, which a watch on the old inode would never see).
+// Returns the watch descriptor, or -1 - also when the table of watched
+// directories is full, since invalidate() couldn't map its events back.
+// *changes is the directory's change count as of now.
+int watch_directory_of(const char *path, long *changes) {
+  char directory[PATH_MAX];
+  const char *slash = strrchr(path, '/');
+  if (slash) {
+    int length = slash - path;
+    if (length == 0)
+      length = 1; // "/file"
+    snprintf(directory, sizeof(directory), "%.*s", length, path);
+  } else {
+    strcpy(directory, ".");
+  }
+
+  int watch = inotify_add_watch(inotify_fd, directory, WATCH_EVENTS);
+  if (watch == -1)
+    return -1;
+
+  pthread_mutex_lock(&cache_lock);
+  int known = 0;
+  *changes = 0;
+  for (int i = 0; i < watched_count; i++)
+    if (watched[i].watch == watch) {
+      known = 1;
+      *changes = watched[i].changes;
+    }
+  int full = !known && watched_count == MAX_WATCHED_DIRECTORIES;
+  if (!known && !full) {
+    watched[watched_count].watch = watch;
+    watched[watched_count].directory = strdup(directory);
+    watched[watched_count].changes = 0;
+    watched_count++;
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  if (full) {
+    // nothing cached depends on it
+    inotify_rm_watch(inotify_fd, watch);
+    return -1;
+  }
+  return watch;
+}
+
+// a miss: map the file and (if it fits the budget) remember it
+int load(const char *path, Cached_file **entry_ptr) {
+  // open first: a request for a file that isn't there costs one syscall,
+  // and never a watch
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return NONEXISTENT_FILE;
+
+  struct stat file_info;
+  if (fstat(fd, &file_info) == -1) {
+    close(fd);
+    return FAIL;
+  }
+  if (!S_ISREG(file_info.st_mode)) {
+    close(fd);
+    return NONEXISTENT_FILE;
+  }
+  if (file_info.st_size > cache_budget / STATIC_CACHE_MAX_ENTRY_SHARE) {
+    close(fd);
+    return NOT_CACHEABLE;
+  }
+
+  // A change that lands between here and the insert below is handled by
+  // the watcher before the entry exists, so there is nothing for it to
+  // evict: note the directory's change count now and don't keep what we
+  // mapped if it has moved on.
+  long changes;
+  int watch = watch_directory_of(path, &changes);
+  if (watch == -1) {
+    close(fd);
+    return NOT_CACHEABLE;
+  }
+
+  // one that came before the watch went unseen: the path has to still be
+  // the file we opened, as we opened it
+  struct stat now;
+  int replaced = stat(path, &now) == -1 || now.st_ino != file_info.st_ino ||
+                 now.st_dev != file_info.st_dev ||
+                 now.st_size != file_info.st_size ||
+                 now.st_mtim.tv_sec != file_info.st_mtim.tv_sec ||
+                 now.st_mtim.tv_nsec != file_info.st_mtim.tv_nsec;
+
+  char *data = NULL;
+  if (file_info.st_size > 0) {
+    data = mmap(NULL, file_info.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE,
+                fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return NOT_CACHEABLE;
+    }
+  }
+  close(fd);
+
+  Cached_file *entry = calloc(1, sizeof(Cached_file));
+  entry->path = strdup(path);
+  entry->data = data;
+  entry->size = file_info.st_size;
+  entry->modified = file_info.st_mtim;
+  entry->watch = watch;
+  entry->references = 2; // the cache's and the caller's
+
+  pthread_mutex_lock(&cache_lock);
+
+  if (replaced || directory_changes(watch) != changes) {
+    // good enough for this response, which the change raced anyway
+    pthread_mutex_unlock(&cache_lock);
+    entry->references = 1;
+    *entry_ptr = entry;
+    return SUCCESS;
+  }
+
+  Cached_file *raced = find(path);
+  if (raced)
+    evict(raced); // another thread loaded it too; newest wins
+
+  while (oldest && cache_bytes + entry->size > cache_budget)
+    evict(oldest);
+
+  unsigned bucket = hash_path(path);
+  entry->next_in_bucket = buckets[bucket];
+  buckets[bucket] = entry;
+  lru_push_newest(entry);
+  cache_bytes += entry->size;
+
+  pthread_mutex_unlock(&cache_lock);
+
+  if (debug)
+    fprintf(stderr, "static cache: mapped %s (%ld bytes)\n", path,
+            entry->size);
+
+  *entry_ptr = entry;
+  return SUCCESS;
+}
+
+int static_cache_get(const char *requested_path, Cached_file **entry_ptr) {
+  char path[PATH_MAX];
+  normalize_path(requested_path, path, sizeof(path));
+
+  pthread_mutex_lock(&cache_lock);
+  Cached_file *entry = find(path);
+  if (entry) {
+    entry->references++;
+    lru_unlink(entry);
+    lru_push_newest(entry);
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  if (entry) {
+    *entry_ptr = entry;
+    return SUCCESS;
+  }
+
+  return load(path, entry_ptr);
+}
+
+void static_cache_release(Cached_file *entry) {
+  pthread_mutex_lock(&cache_lock);
+  unmap_if_unused(entry);
+  pthread_mutex_unlock(&cache_lock);
+}
+
+// something changed in a watched directory: drop what it touched
+void invalidate(struct inotify_event *event) {
+  pthread_mutex_lock(&cache_lock);
+
+  const char *directory = NULL;
+  for (int i = 0; i < watched_count; i++)
+    if (watched[i].watch == event->wd || event->mask & IN_Q_OVERFLOW) {
+      watched[i].changes++;
+      if (watched[i].watch == event->wd)
+        directory = watched[i].directory;
+    }
+
+  if (event->mask & IN_IGNORED) {
+    // the kernel may hand this descriptor out again for another directory
+    for (int i = 0; i < watched_count; i++)
+      if (watched[i].watch == event->wd) {
+        free(watched[i].directory);
+        watched[i] = watched[--watched_count];
+        break;
+      }
+  }
+
+  if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED) ||
+      event->mask & IN_Q_OVERFLOW || !event->len) {
+    // the directory itself went away, or we lost events: start over for
+    // everything that could be affected
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+      Cached_file *entry = buckets[i];
+      while (entry) {
+        Cached_file *next = entry->next_in_bucket;
+        if (event->mask & IN_Q_OVERFLOW || entry->watch == event->wd)
+          evict(entry);
+        entry = next;
+      }
+    }
+  } else if (directory) {
+    char changed[PATH_MAX];
+    char path[PATH_MAX];
+    if (!strcmp(directory, "."))
+      snprintf(changed, sizeof(changed), "%s", event->name);
+    else
+      snprintf(changed, sizeof(changed), "%s/%s", directory, event->name);
+    normalize_path(changed, path, sizeof(path));
+
+    Cached_file *entry = find(path);
+    if (entry)
+      evict(entry);
+  }
+
+  pthread_mutex_unlock(&cache_lock);
+}
+
+void *static_cache_watch_threadfunc(void *unused) {
+  char events[64 * 1024]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (1) {
+    int length = read(inotify_fd, events, sizeof(events));
+    if (length <= 0) {
+      if (length == -1 && errno == EINTR)
+        continue;
+      perror("inotify read");
+      break;
+    }
+
+    for (char *p = events; p < events + length;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      invalidate(event);
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+
+  // without invalidation we can't trust the cache any more
+  pthread_mutex_lock(&cache_lock);
+  cache_budget = 0;
+  while (oldest)
+    evict(oldest);
+  pthread_mutex_unlock(&cache_lock);
+  return NULL;
+}
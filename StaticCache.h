@@ -0,0 +1,43 @@
+#include <time.h>
+
+#include "Client.h"
+
+#ifndef STATICCACHE_H
+#define STATICCACHE_H
+
+// Shared cache of mmap'd /static/ files, keyed by path. A hit is a hash
+// lookup under a short lock - no open, stat or read. Entries are dropped
+// when inotify reports a change in their directory, and least recently
+// used ones are unmapped to stay under the memory budget. A response
+// still using a file that gets truncated in place fails rather than
+// crashing the server (see client_catch_copy_faults()).
+
+// static_cache_get() result for files we don't map (too big for the budget)
+#define NOT_CACHEABLE 5
+
+// no single file may take more than this share of the budget
+#define STATIC_CACHE_MAX_ENTRY_SHARE 4
+
+typedef struct Cached_file {
+  char *path;
+  char *data; // the mapping (NULL for empty files)
+  long size;
+  struct timespec modified;
+
+  int references; // the cache's own, plus one per response using it
+  int watch;      // inotify watch on the file's directory
+  struct Cached_file *next_in_bucket;
+  struct Cached_file *newer; // LRU list
+  struct Cached_file *older;
+} Cached_file;
+
+// 0 budget leaves the cache off. Returns FAIL if inotify is unavailable.
+int static_cache_init(long budget_bytes);
+int static_cache_enabled(void);
+
+// SUCCESS with *entry (hand it back with static_cache_release()),
+// NONEXISTENT_FILE, NOT_CACHEABLE or FAIL.
+int static_cache_get(const char *path, Cached_file **entry);
+void static_cache_release(Cached_file *entry);
+
+#endif
@@ -0,0 +1,128 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "Client.h"
+#include "Ticker.h"
+
+long monotonic_ns;
+long realtime_ns;
+
+// Seqlock: the ticker makes sequence odd while it rewrites line, and
+// readers retry if they saw it odd or saw it change under them.
+struct {
+  unsigned sequence;
+  char line[TICKER_DATE_LINE_LENGTH];
+} date;
+
+long date_second = -1; // ticker's only
+
+void *ticker_threadfunc(void *);
+
+long timespec_ns(struct timespec *t) {
+  return t->tv_sec * 1000000000L + t->tv_nsec;
+}
+
+// value's last two digits at out; returns the new end
+char *append_two_digits(char *out, int value) {
+  out[0] = '0' + value / 10 % 10;
+  out[1] = '0' + value % 10;
+  return out + 2;
+}
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n", written out field by field:
+// every piece has a fixed width, so the line is always exactly
+// TICKER_DATE_LINE_LENGTH bytes
+void format_date_line(long second, char *line) {
+  static const char days[] = "SunMonTueWedThuFriSat";
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  time_t seconds = second;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  int year = tm.tm_year + 1900;
+
+  char *out = line;
+  memcpy(out, "Date: ", 6);
+  memcpy(out + 6, days + tm.tm_wday * 3, 3);
+  memcpy(out + 9, ", ", 2);
+  out = append_two_digits(out + 11, tm.tm_mday);
+  *out++ = ' ';
+  memcpy(out, months + tm.tm_mon * 3, 3);
+  out[3] = ' ';
+  out = append_two_digits(out + 4, year / 100);
+  out = append_two_digits(out, year);
+  *out++ = ' ';
+  out = append_two_digits(out, tm.tm_hour);
+  *out++ = ':';
+  out = append_two_digits(out, tm.tm_min);
+  *out++ = ':';
+  out = append_two_digits(out, tm.tm_sec);
+  memcpy(out, " GMT\r\n", 6);
+}
+
+void ticker_tick(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  __atomic_store_n(&monotonic_ns, timespec_ns(&now), __ATOMIC_RELAXED);
+  clock_gettime(CLOCK_REALTIME, &now);
+  __atomic_store_n(&realtime_ns, timespec_ns(&now), __ATOMIC_RELAXED);
+
+  if (now.tv_sec == date_second)
+    return;
+  date_second = now.tv_sec;
+
+  char line[TICKER_DATE_LINE_LENGTH];
+  format_date_line(now.tv_sec, line);
+
+  __atomic_store_n(&date.sequence, date.sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(date.line, line, TICKER_DATE_LINE_LENGTH);
+  __atomic_store_n(&date.sequence, date.sequence + 1, __ATOMIC_RELEASE);
+}
+
+int ticker_start(void) {
+  ticker_tick();
+
+  pthread_t ticker;
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  int result = pthread_create(&ticker, &attributes, ticker_threadfunc, NULL);
+  pthread_attr_destroy(&attributes);
+
+  if (result != 0) {
+    errno = result;
+    perror("pthread_create ticker");
+    return FAIL;
+  }
+  return SUCCESS;
+}
+
+void *ticker_threadfunc(void *unused) {
+  struct timespec period = {.tv_sec = 0, .tv_nsec = TICKER_PERIOD_NS};
+  while (1) {
+    nanosleep(&period, NULL);
+    ticker_tick();
+  }
+}
+
+long ticker_monotonic_ns(void) {
+  return __atomic_load_n(&monotonic_ns, __ATOMIC_RELAXED);
+}
+
+long ticker_realtime_ns(void) {
+  return __atomic_load_n(&realtime_ns, __ATOMIC_RELAXED);
+}
+
+int ticker_date_line(char *out) {
+  unsigned before, after;
+  do {
+    before = __atomic_load_n(&date.sequence, __ATOMIC_ACQUIRE);
+    memcpy(out, date.line, TICKER_DATE_LINE_LENGTH);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&date.sequence, __ATOMIC_RELAXED);
+  } while ((before & 1) || before != after);
+  return TICKER_DATE_LINE_LENGTH;
+}
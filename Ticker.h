@@ -0,0 +1,27 @@
+#ifndef TICKER_H
+#define TICKER_H
+
+// Coarse clocks and the HTTP Date header, kept current by one background
+// thread so that serving threads never call time functions per request.
+// The clocks advance every TICKER_PERIOD_NS; the Date line is reformatted
+// only when the wall-clock second changes. Anything that needs real
+// precision (latency, durations) still reads CLOCK_MONOTONIC itself.
+
+#define TICKER_PERIOD_NS 10000000
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+#define TICKER_DATE_LINE_LENGTH 37
+
+// Sets the clocks and starts the ticker thread; call once, after the
+// signal mask serving threads should inherit is in place.
+int ticker_start(void);
+
+// CLOCK_MONOTONIC / CLOCK_REALTIME as of the last tick, in ns
+long ticker_monotonic_ns(void);
+long ticker_realtime_ns(void);
+
+// Copies the current Date header line (TICKER_DATE_LINE_LENGTH bytes, no
+// NUL) to out. Returns its length.
+int ticker_date_line(char *out);
+
+#endif
@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "TimerWheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void timer_wheel_init(Timer_wheel *wheel, long now_ns, pthread_mutex_t *lock) {
+  memset(wheel->slots, 0, sizeof(wheel->slots));
+  wheel->current_tick = now_ns / TIMER_WHEEL_TICK_NS;
+  wheel->lock = lock;
+}
+
+void unlink_timer(Timer *timer) {
+  if (!timer->previous_next)
+    return;
+  *timer->previous_next = timer->next;
+  if (timer->next)
+    timer->next->previous_next = timer->previous_next;
+  timer->next = NULL;
+  timer->previous_next = NULL;
+}
+
+// The lowest level whose span covers the wait; the slot there is picked by
+// the expiry tick's own bits, so it comes round exactly in time to be
+// moved down a level. Nothing goes off before tick earliest.
+void place_timer(Timer_wheel *wheel, Timer *timer, long earliest) {
+  if (timer->expires < earliest)
+    timer->expires = earliest;
+  long wait = timer->expires - wheel->current_tick;
+
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         wait >= 1L << (TIMER_WHEEL_SLOT_BITS * (level + 1)))
+    level++;
+  if (wait >= 1L << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) {
+    // past the top level's reach; park it as far out as we can
+    timer->expires = wheel->current_tick +
+                     (1L << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1;
+  }
+
+  Timer **slot = &wheel->slots[level][(timer->expires >>
+                                       (TIMER_WHEEL_SLOT_BITS * level)) &
+                                      SLOT_MASK];
+  timer->next = *slot;
+  timer->previous_next = slot;
+  if (*slot)
+    (*slot)->previous_next = &timer->next;
+  *slot = timer;
+}
+
+void timer_wheel_arm(Timer_wheel *wheel, Timer *timer, long deadline_ns) {
+  if (wheel->lock)
+    pthread_mutex_lock(wheel->lock);
+  unlink_timer(timer);
+  timer->expires =
+      (deadline_ns + TIMER_WHEEL_TICK_NS - 1) / TIMER_WHEEL_TICK_NS;
+  // the current tick's slot has been expired already
+  place_timer(wheel, timer, wheel->current_tick + 1);
+  if (wheel->lock)
+    pthread_mutex_unlock(wheel->lock);
+}
+
+void timer_wheel_cancel(Timer_wheel *wheel, Timer *timer) {
+  if (wheel->lock)
+    pthread_mutex_lock(wheel->lock);
+  unlink_timer(timer);
+  if (wheel->lock)
+    pthread_mutex_unlock(wheel->lock);
+}
+
+// Re-files every timer in a higher level's slot one or more levels down.
+// Runs before the current tick's own slot is expired, so timers due now
+// still make it.
+void cascade(Timer_wheel *wheel, int level, int index) {
+  Timer *timer = wheel->slots[level][index];
+  wheel->slots[level][index] = NULL;
+  while (timer) {
+    Timer *next = timer->next;
+    place_timer(wheel, timer, wheel->current_tick);
+    timer = next;
+  }
+}
+
+int timer_wheel_expire(Timer_wheel *wheel, long now_ns,
+                       void (*expired)(void *context, void *owner),
+                       void *context) {
+  long now_tick = now_ns / TIMER_WHEEL_TICK_NS;
+  int count = 0;
+
+  if (wheel->lock)
+    pthread_mutex_lock(wheel->lock);
+
+  while (wheel->current_tick < now_tick) {
+    long tick = ++wheel->current_tick;
+
+    // a level's slot comes due when every level below it wraps
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      if (tick & ((1L << (TIMER_WHEEL_SLOT_BITS * level)) - 1))
+        break;
+      cascade(wheel, level,
+              (tick >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+    }
+
+    Timer **slot = &wheel->slots[0][tick & SLOT_MASK];
+    while (*slot) {
+      Timer *timer = *slot;
+      unlink_timer(timer);
+      count++;
+      expired(context, timer->owner);
+    }
+  }
+
+  if (wheel->lock)
+    pthread_mutex_unlock(wheel->lock);
+  return count;
+}
@@ -0,0 +1,49 @@
+#include <pthread.h>
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+// Hierarchical timer wheel: TIMER_WHEEL_LEVELS rings of
+// TIMER_WHEEL_SLOTS lists, each level's slots TIMER_WHEEL_SLOTS times
+// coarser than the one below. Timers live on intrusive lists, so arming
+// and cancelling are O(1) whatever the number of timers; a timer moves
+// down a level only when its slot comes round. Deadlines are rounded up
+// to whole ticks.
+
+#define TIMER_WHEEL_TICK_NS 100000000L // 100ms
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+// 64^4 ticks of 100ms: deadlines up to ~19 days out
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct Timer {
+  struct Timer *next;
+  struct Timer **previous_next; // NULL when not armed
+  long expires;                 // tick
+  void *owner;
+} Timer;
+
+typedef struct {
+  long current_tick; // every slot up to here has been expired
+  Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  // NULL for a wheel only its own thread touches; otherwise held by every
+  // call, and across the expiry callbacks
+  pthread_mutex_t *lock;
+} Timer_wheel;
+
+void timer_wheel_init(Timer_wheel *wheel, long now_ns, pthread_mutex_t *lock);
+
+// (Re)arms timer to go off at deadline_ns (on the same clock as now_ns).
+void timer_wheel_arm(Timer_wheel *wheel, Timer *timer, long deadline_ns);
+// harmless on a timer that isn't armed
+void timer_wheel_cancel(Timer_wheel *wheel, Timer *timer);
+
+// Moves the wheel up to now_ns and calls expired(context, owner) for
+// every timer that has gone off, all in one batch. Each timer is disarmed
+// before its callback, so the callback may free its owner - but on a
+// locked wheel it mustn't arm or cancel. Returns how many expired.
+int timer_wheel_expire(Timer_wheel *wheel, long now_ns,
+                       void (*expired)(void *context, void *owner),
+                       void *context);
+
+#endif
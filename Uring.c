@@ -0,0 +1,643 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Handoff.h"
+#include "Metrics.h"
+#include "Server.h"
+#include "Ticker.h"
+#include "Uring.h"
+
+#define URING_ENTRIES 1024
+#define URING_BUFFER_COUNT 512 // must be a power of two
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+#define URING_SEND_CHUNK (256 * 1024)
+#define URING_MAX_LINKED_SENDS 32
+
+// what a completion is for; lives in the low bits of user_data, the rest
+// is the Uring_conn pointer (NULL for the accept and its cancel)
+#define OP_CANCEL 0
+#define OP_ACCEPT 1
+#define OP_RECV 2
+#define OP_SEND 3
+#define OP_MASK 3
+
+typedef struct {
+  Client *client;
+  int pending_ops; // SQEs whose last CQE has not come back yet
+  int recv_armed;
+  int closing;
+  int hanging_up; // close once what's queued has gone out
+
+  // output currently owned by the kernel; client_write() keeps filling
+  // client->output meanwhile and the two buffers are swapped per batch
+  char *sending;
+  int sending_length;
+  int sending_size;
+  int sends_in_flight;
+  int sent;
+  Unsent_responses sending_responses; // what the buffer being sent answers
+} Uring_conn;
+
+typedef struct {
+  int index;
+  int listen_socket;
+  int ring_fd;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_entries;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_local_tail; // includes SQEs not yet published to the kernel
+  unsigned to_submit;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  struct io_uring_buf_ring *buf_ring;
+  char *buffers;
+
+  Timer_wheel timeouts; // every connection of this ring's
+
+  int accepting;        // until the accept's last completion is in
+  int accept_cancelled; // draining: the accept has been asked to stop
+} Ring;
+
+void *uring_loop_threadfunc(void *);
+
+// Waits (for wait_for completions) no longer than a timer wheel tick, so
+// timeouts get looked at even when nothing happens.
+int uring_enter(Ring *r, unsigned wait_for) {
+  __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+
+  struct __kernel_timespec tick = {.tv_sec = 0,
+                                   .tv_nsec = TIMER_WHEEL_TICK_NS};
+  struct io_uring_getevents_arg wait = {.ts = (uintptr_t)&tick};
+  unsigned flags = wait_for ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG
+                            : 0;
+
+  int result = syscall(__NR_io_uring_enter, r->ring_fd, r->to_submit,
+                       wait_for, flags, wait_for ? &wait : NULL,
+                       wait_for ? sizeof(wait) : 0);
+  if (result < 0) {
+    if (errno == EINTR || errno == EAGAIN || errno == EBUSY ||
+        errno == ETIME)
+      return SUCCESS;
+    perror("io_uring_enter");
+    return FAIL;
+  }
+
+  r->to_submit -= result;
+  return SUCCESS;
+}
+
+// next free SQE, zeroed; submits what we have if the queue is full
+struct io_uring_sqe *uring_get_sqe(Ring *r) {
+  while (r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >=
+         *r->sq_entries) {
+    if (uring_enter(r, 0) == FAIL)
+      return NULL;
+  }
+
+  unsigned index = r->sq_local_tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[index] = index;
+  r->sq_local_tail++;
+  r->to_submit++;
+  return sqe;
+}
+
+// hand buffer bid back to the kernel's provided-buffer ring
+void uring_recycle_buffer(Ring *r, int bid) {
+  unsigned short tail = r->buf_ring->tail;
+  struct io_uring_buf *buf =
+      &r->buf_ring->bufs[tail & (URING_BUFFER_COUNT - 1)];
+
+  // don't memset: bufs[0].resv is where the ring tail lives
+  buf->addr = (uint64_t)(uintptr_t)(r->buffers + bid * URING_BUFFER_SIZE);
+  buf->len = URING_BUFFER_SIZE;
+  buf->bid = bid;
+
+  __atomic_store_n(&r->buf_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+int uring_setup(Ring *r) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+  params.cq_entries = URING_ENTRIES * 4;
+
+  r->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (r->ring_fd < 0 && errno == EINVAL) {
+    // older kernel: no COOP_TASKRUN
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_ENTRIES * 4;
+    r->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  }
+  if (r->ring_fd < 0) {
+    perror("io_uring_setup");
+    return FAIL;
+  }
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    fputs("io_uring: kernel too old (no single mmap)\n", stderr);
+    return FAIL;
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    fputs("io_uring: kernel too old (no timed waits)\n", stderr);
+    return FAIL;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+  char *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->ring_fd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED) {
+    perror("mmap io_uring");
+    return FAIL;
+  }
+
+  r->sq_head = (unsigned *)(ring + params.sq_off.head);
+  r->sq_tail = (unsigned *)(ring + params.sq_off.tail);
+  r->sq_mask = (unsigned *)(ring + params.sq_off.ring_mask);
+  r->sq_entries = (unsigned *)(ring + params.sq_off.ring_entries);
+  r->sq_array = (unsigned *)(ring + params.sq_off.array);
+  r->sq_local_tail = *r->sq_tail;
+  r->to_submit = 0;
+
+  r->cq_head = (unsigned *)(ring + params.cq_off.head);
+  r->cq_tail = (unsigned *)(ring + params.cq_off.tail);
+  r->cq_mask = (unsigned *)(ring + params.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+  r->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->ring_fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    perror("mmap io_uring sqes");
+    return FAIL;
+  }
+
+  // provided buffers: the ring must be page aligned, hence mmap
+  r->buf_ring = mmap(NULL, URING_BUFFER_COUNT * sizeof(struct io_uring_buf),
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                     0);
+  if (r->buf_ring == MAP_FAILED) {
+    perror("mmap buffer ring");
+    return FAIL;
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)r->buf_ring;
+  reg.ring_entries = URING_BUFFER_COUNT;
+  reg.bgid = URING_BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, r->ring_fd, IORING_REGISTER_PBUF_RING,
+              &reg, 1) < 0) {
+    perror("io_uring register buffer ring");
+    return FAIL;
+  }
+
+  r->buffers = malloc(URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+  if (!r->buffers) {
+    perror("malloc uring buffers");
+    return FAIL;
+  }
+  for (int bid = 0; bid < URING_BUFFER_COUNT; bid++)
+    uring_recycle_buffer(r, bid);
+
+  return SUCCESS;
+}
+
+int uring_arm_accept(Ring *r) {
+  struct io_uring_sqe *sqe = uring_get_sqe(r);
+  if (!sqe)
+    return FAIL;
+
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = r->listen_socket;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = OP_ACCEPT;
+  return SUCCESS;
+}
+
+// draining: the multishot accept ends with an -ECANCELED completion
+int uring_cancel_accept(Ring *r) {
+  struct io_uring_sqe *sqe = uring_get_sqe(r);
+  if (!sqe)
+    return FAIL;
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = OP_ACCEPT;
+  sqe->user_data = OP_CANCEL;
+  return SUCCESS;
+}
+
+int uring_arm_recv(Ring *r, Uring_conn *conn) {
+  struct io_uring_sqe *sqe = uring_get_sqe(r);
+  if (!sqe)
+    return FAIL;
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = client_socket(conn->client);
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | OP_RECV;
+
+  conn->recv_armed = 1;
+  conn->pending_ops++;
+  return SUCCESS;
+}
+
+// Queue what is left of conn->sending as a chain of linked sends; the
+// link keeps them in order and MSG_WAITALL makes a short send an error,
+// which cancels the rest of the chain.
+int uring_submit_sends(Ring *r, Uring_conn *conn) {
+  int offset = conn->sent;
+
+  while (offset < conn->sending_length &&
+         conn->sends_in_flight < URING_MAX_LINKED_SENDS) {
+    int length = conn->sending_length - offset;
+    if (length > URING_SEND_CHUNK)
+      length = URING_SEND_CHUNK;
+
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if (!sqe)
+      return FAIL;
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = client_socket(conn->client);
+    sqe->addr = (uint64_t)(uintptr_t)(conn->sending + offset);
+    sqe->len = length;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = (uint64_t)(uintptr_t)conn | OP_SEND;
+
+    offset += length;
+    conn->sends_in_flight++;
+    conn->pending_ops++;
+
+    if (offset < conn->sending_length &&
+        conn->sends_in_flight < URING_MAX_LINKED_SENDS)
+      sqe->flags = IOSQE_IO_LINK;
+  }
+
+  return SUCCESS;
+}
+
+// start sending whatever the handlers queued, unless a batch is in flight
+int uring_flush_output(Ring *r, Uring_conn *conn) {
+  Client *cl = conn->client;
+  if (conn->sends_in_flight > 0)
+    return SUCCESS;
+
+  // a file goes out URING_SEND_CHUNK at a time, so the responses it
+  // answers are only sent once the last piece is
+  int last = cl->queued.count == 0;
+  if (client_next_output(cl, &conn->sending, &conn->sending_size,
+                         &conn->sending_length, URING_SEND_CHUNK) == FAIL)
+    return FAIL;
+  conn->sent = 0;
+  if (last) {
+    conn->sending_responses = cl->unsent;
+    cl->unsent.count = 0;
+  }
+
+  if (conn->sending_length == 0) {
+    client_responses_sent(&conn->sending_responses); // all out already
+    return SUCCESS;
+  }
+  return uring_submit_sends(r, conn);
+}
+
+void uring_release_if_idle(Uring_conn *conn) {
+  if (!conn->closing || conn->pending_ops > 0)
+    return;
+
+  client_free(conn->client);
+  buffer_pool_put(conn->sending, conn->sending_size);
+  free(conn);
+}
+
+// Shutting the socket down makes the kernel finish our outstanding recv
+// and sends; the connection is freed once their CQEs are all back.
+void uring_close(Ring *r, Uring_conn *conn, const char *why) {
+  if (conn->closing)
+    return;
+
+  if (debug)
+    fprintf(stderr, "ring %d: client %d %s - closing\n", r->index,
+            client_id(conn->client), why);
+
+  conn->closing = 1;
+  shutdown(client_socket(conn->client), SHUT_RDWR);
+  uring_release_if_idle(conn);
+}
+
+void uring_handle_accept(Ring *r, struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    if (__atomic_load_n(&draining, __ATOMIC_ACQUIRE)) {
+      r->accepting = 0;
+      __atomic_sub_fetch(&accepting_loops, 1, __ATOMIC_RELEASE);
+    } else {
+      uring_arm_accept(r);
+    }
+  }
+
+  if (cqe->res == -ECANCELED)
+    return;
+  if (cqe->res < 0) {
+    errno = -cqe->res;
+    perror("accept failed");
+    return;
+  }
+
+  // multishot accept can't fill in a per-connection address
+  struct sockaddr_in client_addr;
+  memset(&client_addr, 0, sizeof(client_addr));
+
+  Client *cl = client_new(cqe->res, &client_addr);
+  if (!cl) {
+    if (debug)
+      fputs("connection table full - refusing a client\n", stderr);
+    close(cqe->res);
+    return;
+  }
+
+  Uring_conn *conn = calloc(1, sizeof(Uring_conn));
+  if (!conn) {
+    perror("calloc uring connection");
+    client_free(cl);
+    return;
+  }
+  conn->client = cl;
+  conn->client->buffer_output = 1;
+  conn->client->timeouts = &r->timeouts;
+  conn->client->timeout.owner = conn;
+  client_arm_timeout(conn->client);
+
+  if (debug)
+    fprintf(stderr, "ring %d accepted client %d (fd %d)\n", r->index,
+            client_id(conn->client), cqe->res);
+
+  if (uring_arm_recv(r, conn) == FAIL)
+    uring_close(r, conn, "could not arm recv");
+}
+
+// Answers the complete requests buffered so far and queues the sends.
+// Returns FAIL if the connection is closing.
+int uring_serve(Ring *r, Uring_conn *conn) {
+  Client *cl = conn->client;
+
+  int served = serve_buffered_requests(cl);
+  if (served != SUCCESS) {
+    // the error reply (or the last one, while draining) is queued; let it
+    // go out before hanging up
+    conn->hanging_up = 1;
+    if (uring_flush_output(r, conn) == FAIL || conn->sends_in_flight == 0)
+      uring_close(r, conn, served == FAIL ? "response failed"
+                                          : "closed socket");
+    return FAIL;
+  }
+  if (uring_flush_output(r, conn) == FAIL) {
+    uring_close(r, conn, "response failed");
+    return FAIL;
+  }
+  client_release_idle_input(cl);
+  client_arm_timeout(cl);
+  return SUCCESS;
+}
+
+void uring_handle_recv(Ring *r, Uring_conn *conn, struct io_uring_cqe *cqe) {
+  Client *cl = conn->client;
+  int appended = SUCCESS;
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res > 0 && !conn->closing)
+      appended = client_append_input(cl, r->buffers + bid * URING_BUFFER_SIZE,
+                                     cqe->res, MAX_MESSAGE_LENGTH);
+    uring_recycle_buffer(r, bid);
+  }
+
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    conn->recv_armed = 0;
+    conn->pending_ops--;
+  }
+
+  if (conn->closing) {
+    uring_release_if_idle(conn);
+    return;
+  }
+
+  if (cqe->res == 0) {
+    uring_close(r, conn, "closed socket");
+    return;
+  }
+
+  if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+    errno = -cqe->res;
+    perror("recv");
+    metrics_count(METRIC_IO_ERRORS);
+    uring_close(r, conn, "read failed");
+    return;
+  }
+
+  if (conn->hanging_up)
+    return;
+
+  if (appended == FAIL) {
+    uring_close(r, conn, "request too long");
+    return;
+  }
+
+  if (uring_serve(r, conn) == FAIL)
+    return;
+
+  // ran out of provided buffers, or the kernel ended the multishot
+  if (!conn->recv_armed && uring_arm_recv(r, conn) == FAIL)
+    uring_close(r, conn, "could not arm recv");
+}
+
+void uring_handle_send(Ring *r, Uring_conn *conn, struct io_uring_cqe *cqe) {
+  conn->pending_ops--;
+  conn->sends_in_flight--;
+  if (cqe->res > 0) {
+    conn->sent += cqe->res;
+    metrics_add(METRIC_BYTES_OUT, cqe->res);
+  }
+
+  if (conn->closing) {
+    uring_release_if_idle(conn);
+    return;
+  }
+
+  if (conn->sends_in_flight > 0)
+    return;
+
+  if (conn->sent < conn->sending_length) {
+    // either the chain was cut at URING_MAX_LINKED_SENDS, or a send failed
+    // (and the rest of the chain came back -ECANCELED)
+    if (cqe->res < 0) {
+      metrics_count(METRIC_IO_ERRORS);
+      uring_close(r, conn, "write failed");
+      return;
+    }
+    if (uring_submit_sends(r, conn) == FAIL)
+      uring_close(r, conn, "could not queue send");
+    return;
+  }
+
+  client_responses_sent(&conn->sending_responses);
+  conn->sending_length = 0;
+
+  // batch done: unless a file is still going out, the buffer goes back to
+  // the pool so idle clients hold none
+  Client *cl = conn->client;
+  if (cl->queued.count == 0) {
+    buffer_pool_put(conn->sending, conn->sending_size);
+    conn->sending = NULL;
+    conn->sending_size = 0;
+  }
+
+  // serving stopped at the high-water mark with requests still buffered;
+  // no recv is coming for those, so pick them up now the batch is out
+  if (!conn->hanging_up && cl->input_length > cl->input_start) {
+    uring_serve(r, conn);
+    return;
+  }
+
+  if (uring_flush_output(r, conn) == FAIL)
+    uring_close(r, conn, "could not queue send");
+  else if (conn->hanging_up && conn->sends_in_flight == 0)
+    uring_close(r, conn, "hung up");
+  else
+    client_arm_timeout(cl); // a file going out restarts the send clock
+}
+
+int uring_reap(Ring *r) {
+  unsigned head = *r->cq_head;
+  unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    Uring_conn *conn = (Uring_conn *)(uintptr_t)(cqe->user_data & ~OP_MASK);
+
+    switch (cqe->user_data & OP_MASK) {
+    case OP_CANCEL:
+      break;
+    case OP_ACCEPT:
+      if (cqe->res == -EINVAL) {
+        fputs("io_uring: kernel lacks multishot accept\n", stderr);
+        return FAIL;
+      }
+      uring_handle_accept(r, cqe);
+      break;
+    case OP_RECV:
+      uring_handle_recv(r, conn, cqe);
+      break;
+    case OP_SEND:
+      uring_handle_send(r, conn, cqe);
+      break;
+    }
+
+    head++;
+    // let the kernel reuse the slot as early as possible
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  }
+
+  return SUCCESS;
+}
+
+void uring_timed_out(void *context, void *owner) {
+  metrics_count(METRIC_TIMEOUTS);
+  uring_close((Ring *)context, (Uring_conn *)owner, "timed out");
+}
+
+int uring_loop_run(int *listen_sockets, int socket_count, int thread_count) {
+  pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+  Ring *rings = calloc(thread_count, sizeof(Ring));
+
+  // set every ring up before starting any, so a kernel without io_uring
+  // support is reported once, up front
+  for (int i = 0; i < thread_count; i++) {
+    rings[i].index = i;
+    rings[i].listen_socket = listen_sockets[i % socket_count];
+    timer_wheel_init(&rings[i].timeouts, ticker_monotonic_ns(), NULL);
+    if (uring_setup(&rings[i]) == FAIL)
+      return FAIL;
+  }
+
+  for (int i = 0; i < thread_count; i++) {
+    int result = pthread_create(&threads[i], NULL, uring_loop_threadfunc,
+                                (void *)&rings[i]);
+    if (result != 0) {
+      errno = result;
+      perror("pthread_create");
+      return FAIL;
+    }
+  }
+
+  if (debug)
+    fprintf(stderr, "%d io_uring threads running\n", thread_count);
+
+  // an upgrade: the old server can stop accepting now
+  handoff_ready();
+
+  for (int i = 0; i < thread_count; i++)
+    pthread_join(threads[i], NULL);
+
+  free(threads);
+  free(rings);
+  return FAIL;
+}
+
+void *uring_loop_threadfunc(void *payload_ptr) {
+  Ring *r = (Ring *)payload_ptr;
+
+  pin_thread_to_cpu(r->index);
+
+  if (uring_arm_accept(r) == FAIL)
+    return NULL;
+  r->accepting = 1;
+
+  while (1) {
+    // after an upgrade the new process does the accepting
+    if (r->accepting && !r->accept_cancelled &&
+        __atomic_load_n(&draining, __ATOMIC_ACQUIRE)) {
+      if (uring_cancel_accept(r) == FAIL)
+        return NULL;
+      r->accept_cancelled = 1;
+    }
+
+    if (uring_enter(r, 1) == FAIL)
+      return NULL;
+    if (uring_reap(r) == FAIL)
+      return NULL;
+    timer_wheel_expire(&r->timeouts, ticker_monotonic_ns(), uring_timed_out,
+                       r);
+  }
+}
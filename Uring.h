@@ -0,0 +1,17 @@
+#ifndef URING_H
+#define URING_H
+
+// io_uring serving mode. Each loop thread owns a ring with
+//  - one multishot accept on its listening socket,
+//  - one multishot recv per client, filled from a kernel-provided
+//    buffer ring, and
+//  - responses queued by client_write() and sent as a linked chain of
+//    send SQEs, so they go out in order without waiting on each other.
+// Submitting and reaping share a single io_uring_enter() per loop pass.
+
+// Runs thread_count ring threads; ring i accepts on
+// listen_sockets[i % socket_count]. Returns FAIL when the kernel has no
+// usable io_uring (or a ring died); never returns otherwise.
+int uring_loop_run(int *listen_sockets, int socket_count, int thread_count);
+
+#endif
@@ -0,0 +1,140 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Server.h"
+#include "WorkerPool.h"
+
+// Bounded MPMC ring (Vyukov): every slot carries a sequence number telling
+// producers and consumers whose turn it is, so neither side takes a lock.
+// The semaphores only do the sleeping - free_slots for the acceptor when
+// the ring is full, queued_clients for workers when it is empty.
+typedef struct {
+  size_t sequence;
+  Client *client;
+} Queue_slot;
+
+Queue_slot queue[WORKER_QUEUE_LENGTH];
+size_t enqueue_position __attribute__((aligned(64)));
+size_t dequeue_position __attribute__((aligned(64)));
+
+sem_t free_slots;
+sem_t queued_clients;
+
+Client_handler worker_handler;
+
+void queue_push(Client *cl) {
+  size_t position = __atomic_load_n(&enqueue_position, __ATOMIC_RELAXED);
+
+  while (1) {
+    Queue_slot *slot = &queue[position & (WORKER_QUEUE_LENGTH - 1)];
+    size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    long difference = (long)sequence - (long)position;
+
+    if (difference == 0) {
+      if (__atomic_compare_exchange_n(&enqueue_position, &position,
+                                      position + 1, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        slot->client = cl;
+        __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+        return;
+      }
+    } else {
+      // someone else got this slot; catch up
+      position = __atomic_load_n(&enqueue_position, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+Client *queue_pop(void) {
+  size_t position = __atomic_load_n(&dequeue_position, __ATOMIC_RELAXED);
+
+  while (1) {
+    Queue_slot *slot = &queue[position & (WORKER_QUEUE_LENGTH - 1)];
+    size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    long difference = (long)sequence - (long)(position + 1);
+
+    if (difference == 0) {
+      if (__atomic_compare_exchange_n(&dequeue_position, &position,
+                                      position + 1, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        Client *cl = slot->client;
+        __atomic_store_n(&slot->sequence, position + WORKER_QUEUE_LENGTH,
+                         __ATOMIC_RELEASE);
+        return cl;
+      }
+    } else {
+      position = __atomic_load_n(&dequeue_position, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void *worker_threadfunc(void *unused) {
+  while (1) {
+    if (sem_wait(&queued_clients) == -1)
+      continue; // EINTR
+
+    Client *client = queue_pop();
+    sem_post(&free_slots);
+
+    int client_index = client_id(client);
+    int result = worker_handler(client);
+
+    if (debug)
+      fprintf(stderr, "worker finished client %d, returned %d\n", client_index,
+              result);
+  }
+  return NULL;
+}
+
+int worker_pool_start(int worker_count, Client_handler handler) {
+  worker_handler = handler;
+
+  for (size_t i = 0; i < WORKER_QUEUE_LENGTH; i++)
+    queue[i].sequence = i;
+  enqueue_position = 0;
+  dequeue_position = 0;
+
+  sem_init(&free_slots, 0, WORKER_QUEUE_LENGTH);
+  sem_init(&queued_clients, 0, 0);
+
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE);
+  // nobody ever joins a worker
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+  for (int i = 0; i < worker_count; i++) {
+    pthread_t worker;
+    int result = pthread_create(&worker, &attributes, worker_threadfunc, NULL);
+    if (result != 0) {
+      errno = result;
+      perror("pthread_create worker");
+      pthread_attr_destroy(&attributes);
+      return FAIL;
+    }
+  }
+
+  pthread_attr_destroy(&attributes);
+
+  if (debug)
+    fprintf(stderr, "%d worker threads running\n", worker_count);
+
+  return SUCCESS;
+}
+
+int worker_pool_submit(Client *cl) {
+  // backpressure: wait for a worker to drain a slot
+  while (sem_wait(&free_slots) == -1) {
+    if (errno != EINTR) {
+      perror("sem_wait");
+      return FAIL;
+    }
+  }
+
+  queue_push(cl);
+  sem_post(&queued_clients);
+  return SUCCESS;
+}
@@ -0,0 +1,24 @@
+#include "Client.h"
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+// Fixed set of worker threads fed by the acceptor through a bounded
+// lock-free queue. A worker owns a client until its handler returns.
+
+// small stacks: handlers only keep a few KB on the stack
+#define WORKER_STACK_SIZE (256 * 1024)
+// accepted clients waiting for a worker; must be a power of two
+#define WORKER_QUEUE_LENGTH 256
+
+typedef int (*Client_handler)(Client *cl);
+
+// returns FAIL if the workers could not be started
+int worker_pool_start(int worker_count, Client_handler handler);
+
+// Hands a client to the pool. When every slot is taken this blocks until a
+// worker frees one, so a connection storm backs up into the listen queue
+// instead of growing without limit.
+int worker_pool_submit(Client *cl);
+
+#endif
@@ -0,0 +1,369 @@
+// HTTP load generator for this server: keeps N connections busy (closed
+// loop) or sends at a fixed rate (open loop) and reports throughput and
+// latency percentiles. Built and driven by `make bench`.
+//
+// Open-loop latencies are measured from when each request was *supposed*
+// to go out, not when a busy connection got around to sending it, so a
+// server stall shows up in the tail instead of silently lowering the
+// offered load (coordinated omission).
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FAIL 0
+#define SUCCESS 2
+
+#define MAX_PATHS 64
+#define RESPONSE_BUFFER_SIZE (64 * 1024)
+
+// settings
+const char *host = "127.0.0.1";
+int port = 8888;
+int connection_count = 32;
+double duration_seconds = 5;
+double request_rate = 0; // total requests/s; 0 = closed loop
+int keep_alive = 1;
+const char *paths[MAX_PATHS];
+int path_count = 0;
+
+struct sockaddr_in server_address;
+uint64_t start_ns;
+uint64_t end_ns;
+
+typedef struct {
+  int index;
+  int socket_fd;
+  int server_closing; // the last response said Connection: close
+  char buffer[RESPONSE_BUFFER_SIZE];
+
+  uint64_t *latencies; // ns
+  long latency_count;
+  long latency_size;
+  long errors;
+  long bytes;
+} Connection;
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void sleep_until(uint64_t when_ns) {
+  struct timespec ts = {.tv_sec = when_ns / 1000000000ull,
+                        .tv_nsec = when_ns % 1000000000ull};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+void record(Connection *c, uint64_t latency) {
+  if (c->latency_count == c->latency_size) {
+    c->latency_size = c->latency_size ? c->latency_size * 2 : 4096;
+    c->latencies = realloc(c->latencies, c->latency_size * sizeof(uint64_t));
+  }
+  c->latencies[c->latency_count++] = latency;
+}
+
+int open_connection(Connection *c) {
+  c->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (c->socket_fd == -1)
+    return FAIL;
+
+  int enable = 1;
+  setsockopt(c->socket_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+  if (connect(c->socket_fd, (struct sockaddr *)&server_address,
+              sizeof(server_address)) == -1) {
+    close(c->socket_fd);
+    c->socket_fd = -1;
+    return FAIL;
+  }
+  return SUCCESS;
+}
+
+void close_connection(Connection *c) {
+  if (c->socket_fd != -1)
+    close(c->socket_fd);
+  c->socket_fd = -1;
+}
+
+int write_all(int fd, const char *data, int length) {
+  while (length > 0) {
+    int result = write(fd, data, length);
+    if (result == -1 && errno == EINTR)
+      continue;
+    if (result <= 0)
+      return FAIL;
+    data += result;
+    length -= result;
+  }
+  return SUCCESS;
+}
+
+// end of the header block (either line ending style), or NULL
+char *find_header_end(char *data, int length, int *header_length) {
+  for (int i = 0; i + 1 < length; i++) {
+    if (data[i] != '\n')
+      continue;
+    if (data[i + 1] == '\n') {
+      *header_length = i + 2;
+      return data + i + 2;
+    }
+    if (i + 2 < length && data[i + 1] == '\r' && data[i + 2] == '\n') {
+      *header_length = i + 3;
+      return data + i + 3;
+    }
+  }
+  return NULL;
+}
+
+long content_length_of(char *headers, int header_length) {
+  for (char *line = headers; line && line < headers + header_length;) {
+    if (!strncasecmp(line, "Content-Length:", 15))
+      return atol(line + 15);
+    line = memchr(line, '\n', headers + header_length - line);
+    if (line)
+      line++;
+  }
+  return 0;
+}
+
+// the server is about to hang up (e.g. draining for an upgrade)
+int says_close(char *headers, int header_length) {
+  for (char *line = headers; line && line < headers + header_length;) {
+    if (!strncasecmp(line, "Connection: close", 17))
+      return 1;
+    line = memchr(line, '\n', headers + header_length - line);
+    if (line)
+      line++;
+  }
+  return 0;
+}
+
+// reads one whole response (headers and Content-Length body)
+int read_response(Connection *c) {
+  int have = 0;
+  int header_length = 0;
+
+  while (!find_header_end(c->buffer, have, &header_length)) {
+    if (have == RESPONSE_BUFFER_SIZE)
+      return FAIL;
+    int result = read(c->socket_fd, c->buffer + have,
+                      RESPONSE_BUFFER_SIZE - have);
+    if (result == -1 && errno == EINTR)
+      continue;
+    if (result <= 0)
+      return FAIL;
+    have += result;
+  }
+
+  c->server_closing = says_close(c->buffer, header_length);
+  long body_left =
+      content_length_of(c->buffer, header_length) - (have - header_length);
+  c->bytes += have;
+
+  while (body_left > 0) {
+    int wanted = body_left < RESPONSE_BUFFER_SIZE ? body_left
+                                                  : RESPONSE_BUFFER_SIZE;
+    int result = read(c->socket_fd, c->buffer, wanted);
+    if (result == -1 && errno == EINTR)
+      continue;
+    if (result <= 0)
+      return FAIL;
+    body_left -= result;
+    c->bytes += result;
+  }
+
+  return SUCCESS;
+}
+
+// one request/response; returns FAIL (and drops the connection) on error
+int exchange(Connection *c, long sequence) {
+  if (c->socket_fd == -1 && open_connection(c) == FAIL)
+    return FAIL;
+
+  char request[1024];
+  int length = snprintf(request, sizeof(request),
+                        "GET %s HTTP/1.1\r\n"
+                        "Host: %s\r\n"
+                        "Connection: %s\r\n"
+                        "\r\n",
+                        paths[sequence % path_count], host,
+                        keep_alive ? "keep-alive" : "close");
+
+  if (write_all(c->socket_fd, request, length) == FAIL ||
+      read_response(c) == FAIL) {
+    close_connection(c);
+    return FAIL;
+  }
+
+  if (!keep_alive || c->server_closing)
+    close_connection(c);
+  return SUCCESS;
+}
+
+void *connection_threadfunc(void *payload_ptr) {
+  Connection *c = (Connection *)payload_ptr;
+  long sequence = c->index;
+
+  if (request_rate <= 0) {
+    // closed loop: next request as soon as the last one is answered
+    while (now_ns() < end_ns) {
+      uint64_t sent = now_ns();
+      if (exchange(c, sequence++) == FAIL)
+        c->errors++;
+      else
+        record(c, now_ns() - sent);
+    }
+  } else {
+    // open loop: this connection's share of the rate, staggered
+    uint64_t interval = (uint64_t)(1e9 * connection_count / request_rate);
+    uint64_t intended = start_ns + interval * c->index / connection_count;
+
+    for (; intended < end_ns; intended += interval) {
+      sleep_until(intended);
+      if (exchange(c, sequence++) == FAIL)
+        c->errors++;
+      else
+        record(c, now_ns() - intended);
+    }
+  }
+
+  close_connection(c);
+  return NULL;
+}
+
+int compare_latencies(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+double percentile_ms(uint64_t *sorted, long count, double fraction) {
+  if (count == 0)
+    return 0;
+  return sorted[(long)(fraction * (count - 1))] / 1e6;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-a address] [-p port] [-c connections] [-d seconds]\n"
+          "          [-r requests_per_second] [-n] [-u path]...\n"
+          "  -c  concurrent connections (default 32)\n"
+          "  -d  how long to run (default 5)\n"
+          "  -r  open loop at this total rate (default: closed loop)\n"
+          "  -n  new connection per request instead of keep-alive\n"
+          "  -u  path to request; repeat for a round-robin mix\n"
+          "      (default /plus/1/2)\n",
+          program);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "a:p:c:d:r:nu:")) != -1) {
+    switch (opt) {
+    case 'a':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'c':
+      connection_count = atoi(optarg);
+      break;
+    case 'd':
+      duration_seconds = atof(optarg);
+      break;
+    case 'r':
+      request_rate = atof(optarg);
+      break;
+    case 'n':
+      keep_alive = 0;
+      break;
+    case 'u':
+      if (path_count < MAX_PATHS)
+        paths[path_count++] = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (connection_count < 1 || duration_seconds <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (path_count == 0)
+    paths[path_count++] = "/plus/1/2";
+
+  server_address.sin_family = AF_INET;
+  server_address.sin_port = htons(port);
+  if (inet_pton(AF_INET, host, &server_address.sin_addr) != 1) {
+    fprintf(stderr, "bad address %s\n", host);
+    return 1;
+  }
+
+  Connection *connections = calloc(connection_count, sizeof(Connection));
+  pthread_t *threads = malloc(connection_count * sizeof(pthread_t));
+
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, 256 * 1024);
+
+  start_ns = now_ns();
+  end_ns = start_ns + (uint64_t)(duration_seconds * 1e9);
+
+  for (int i = 0; i < connection_count; i++) {
+    connections[i].index = i;
+    connections[i].socket_fd = -1;
+    pthread_create(&threads[i], &attributes, connection_threadfunc,
+                   &connections[i]);
+  }
+
+  long count = 0;
+  long errors = 0;
+  long bytes = 0;
+  for (int i = 0; i < connection_count; i++) {
+    pthread_join(threads[i], NULL);
+    count += connections[i].latency_count;
+    errors += connections[i].errors;
+    bytes += connections[i].bytes;
+  }
+  double elapsed = (now_ns() - start_ns) / 1e9;
+
+  uint64_t *all = malloc((count ? count : 1) * sizeof(uint64_t));
+  long filled = 0;
+  for (int i = 0; i < connection_count; i++) {
+    memcpy(all + filled, connections[i].latencies,
+           connections[i].latency_count * sizeof(uint64_t));
+    filled += connections[i].latency_count;
+  }
+  qsort(all, count, sizeof(uint64_t), compare_latencies);
+
+  printf("%s loop, %d connections, %s, %.1fs",
+         request_rate > 0 ? "open" : "closed", connection_count,
+         keep_alive ? "keep-alive" : "connection per request", elapsed);
+  if (request_rate > 0)
+    printf(", target %.0f req/s", request_rate);
+  printf("\n  paths:");
+  for (int i = 0; i < path_count; i++)
+    printf(" %s", paths[i]);
+  printf("\n  requests %ld  errors %ld  throughput %.1f req/s  %.2f MB/s\n",
+         count, errors, count / elapsed, bytes / elapsed / (1024 * 1024));
+  printf("  latency ms: p50 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+         percentile_ms(all, count, 0.50), percentile_ms(all, count, 0.99),
+         percentile_ms(all, count, 0.999), percentile_ms(all, count, 1.0));
+
+  return errors > 0 && count == 0;
+}
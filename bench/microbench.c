@@ -0,0 +1,464 @@
+// Microbenchmarks for the per-request hot paths, timed in isolation over
+// synthetic corpora of realistic requests: framing (client_next_request),
+// dispatch (respond_to_http_request), route lookup on its own (trie and
+// generated perfect hash), the /plus/ handler, and response formatting
+// (send_http_response). No sockets are involved -
+// the client buffers its output, which is thrown away after every op.
+//
+// Reports ns/op and heap allocations/op. With -c the numbers are compared
+// against a saved baseline and anything slower by more than the threshold,
+// or allocating more, is flagged (and the exit status is 1); -s saves a
+// new baseline. `make microbench` does the comparison against
+// bench/microbench_baseline.txt.
+//
+// /static/ is left out on purpose: it is dominated by the file cache and
+// the kernel, which `make bench` covers end to end.
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../Http.h"
+#include "../PerfectRouter.h"
+#include "../Server.h"
+#include "../Ticker.h"
+
+#define CORPUS_SIZE 4096
+#define ROUNDS 9
+#define MIN_ROUND_NS 50000000ull // keep each round above ~50ms
+#define MAX_BENCHMARKS 32
+#define MAX_REQUEST_LENGTH 1024
+
+int debug = 0;
+int draining = 0;
+
+// Every malloc() in the process lands here - libc's own included (sscanf,
+// stdio) - so allocations/op covers everything a request costs.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long allocations = 0;
+
+void *malloc(size_t size) {
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+typedef struct {
+  char *text;
+  int length;
+} Request;
+
+typedef struct {
+  const char *name;
+  double ns_per_op;
+  double allocations_per_op;
+} Result;
+
+// settings
+const char *baseline_to_compare = NULL;
+const char *baseline_to_save = NULL;
+double threshold_percent = 15;
+
+Request parse_corpus[CORPUS_SIZE];
+Request dispatch_corpus[CORPUS_SIZE];
+Request plus_corpus[CORPUS_SIZE];
+Http_request plus_routed[CORPUS_SIZE];
+Http_request dispatch_parsed[CORPUS_SIZE];
+char *body_corpus[CORPUS_SIZE];
+int body_lengths[CORPUS_SIZE];
+
+Client *client;
+
+Result results[MAX_BENCHMARKS];
+int result_count = 0;
+
+// keeps the compiler from dropping work whose result we ignore
+volatile long sink;
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// fixed seed: the corpora, and so the numbers, are the same every run
+static uint64_t random_state = 0x9e3779b97f4a7c15ull;
+
+uint32_t next_random(void) {
+  random_state = random_state * 6364136223846793005ull + 1442695040888963407ull;
+  return (uint32_t)(random_state >> 33);
+}
+
+int random_below(int limit) { return next_random() % limit; }
+
+// a plausible operand: mostly small, sometimes large or negative
+int random_operand(void) {
+  switch (random_below(4)) {
+  case 0:
+    return random_below(10);
+  case 1:
+    return random_below(1000);
+  case 2:
+    return (int)next_random() / 2;
+  default:
+    return -random_below(100000);
+  }
+}
+
+const char *user_agents[] = {
+    "curl/8.5.0",
+    "Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0",
+    "Mozilla/5.0 (Macintosh; Intel Mac OS X 14_5) AppleWebKit/605.1.15 "
+    "(KHTML, like Gecko) Version/17.5 Safari/605.1.15",
+    "python-requests/2.32.3",
+    "x9-loadgen",
+};
+
+const char *other_paths[] = {
+    "/", "/favicon.ico", "/index.html", "/api/v1/status", "/plus",
+};
+
+// request line plus the headers a client would typically send
+Request make_request(const char *method, const char *path, const char *body) {
+  char text[MAX_REQUEST_LENGTH];
+  int length;
+  const char *agent =
+      user_agents[random_below(sizeof(user_agents) / sizeof(*user_agents))];
+
+  if (body)
+    length = snprintf(text, sizeof(text),
+                      "%s %s HTTP/1.1\r\n"
+                      "Host: localhost:8888\r\n"
+                      "User-Agent: %s\r\n"
+                      "Accept: */*\r\n"
+                      "Content-Type: application/x-www-form-urlencoded\r\n"
+                      "Content-Length: %d\r\n"
+                      "\r\n"
+                      "%s",
+                      method, path, agent, (int)strlen(body), body);
+  else
+    length = snprintf(text, sizeof(text),
+                      "%s %s HTTP/1.1\r\n"
+                      "Host: localhost:8888\r\n"
+                      "User-Agent: %s\r\n"
+                      "Accept: */*\r\n"
+                      "Accept-Encoding: gzip, deflate, br\r\n"
+                      "Accept-Language: en-US,en;q=0.5\r\n"
+                      "Connection: keep-alive\r\n"
+                      "\r\n",
+                      method, path, agent);
+
+  Request request = {.text = strdup(text), .length = length};
+  return request;
+}
+
+Request make_plus_request(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/plus/%d/%d", random_operand(),
+           random_operand());
+  return make_request("GET", path, NULL);
+}
+
+// what the mix of routes looks like: mostly /plus/, some misses and some
+// that start right but don't parse
+Request make_dispatch_request(void) {
+  int kind = random_below(10);
+  if (kind < 7)
+    return make_plus_request();
+  if (kind < 9)
+    return make_request(
+        "GET", other_paths[random_below(sizeof(other_paths) / sizeof(*other_paths))],
+        NULL);
+  return make_request("GET", "/plus/abc/7", NULL);
+}
+
+Request make_parse_request(void) {
+  if (random_below(8) == 0)
+    return make_request("POST", "/plus/1/2", "a=1&b=2&note=hello+world");
+  return make_dispatch_request();
+}
+
+void build_corpora(void) {
+  for (int i = 0; i < CORPUS_SIZE; i++) {
+    parse_corpus[i] = make_parse_request();
+    dispatch_corpus[i] = make_dispatch_request();
+    router_parse_request(dispatch_corpus[i].text, &dispatch_parsed[i]);
+    plus_corpus[i] = make_plus_request();
+    Route_handler handler;
+    router_parse_request(plus_corpus[i].text, &plus_routed[i]);
+    router_find(&plus_routed[i], &handler);
+
+    char body[MAX_GENERATED_LENGTH];
+    body_lengths[i] = snprintf(body, sizeof(body), "Sum of %d and %d is %d.\n",
+                               random_operand(), random_operand(),
+                               random_operand());
+    body_corpus[i] = strdup(body);
+  }
+}
+
+// the response is only wanted for its cost. Its latency record goes too,
+// as once a real send path has written it: left to pile up, the table
+// fills and every later response is timed on the spot instead.
+void discard_output(void) {
+  client->output_length = 0;
+  client->unsent.count = 0;
+}
+
+// framing, as the serving loops do it: bytes arrive, a request is cut out
+long bench_parse_request(long op) {
+  Request *request = &parse_corpus[op % CORPUS_SIZE];
+  char *text;
+  int length;
+
+  client_append_input(client, request->text, request->length,
+                      MAX_MESSAGE_LENGTH);
+  client_next_request(client, &text, &length, MAX_MESSAGE_LENGTH);
+  client_finish_request(client);
+  return length;
+}
+
+// the request is copied first since handlers may write into it
+char scratch[MAX_REQUEST_LENGTH];
+
+long bench_dispatch(long op) {
+  Request *request = &dispatch_corpus[op % CORPUS_SIZE];
+  memcpy(scratch, request->text, request->length + 1);
+
+  int result = respond_to_http_request(client, scratch);
+  discard_output();
+  return result;
+}
+
+// the handler alone: its requests were routed up front
+long bench_math_request(long op) {
+  int result = handle_math_request(client, &plus_routed[op % CORPUS_SIZE]);
+  discard_output();
+  return result;
+}
+
+// the trie walk alone; the request lines were split up front
+long bench_route_lookup(long op) {
+  Http_request request = dispatch_parsed[op % CORPUS_SIZE];
+  Route_handler handler;
+  return router_find(&request, &handler);
+}
+
+// the same, through the table tools/routegen built from routes.list
+long bench_perfect_lookup(long op) {
+  Http_request request = dispatch_parsed[op % CORPUS_SIZE];
+  Route_handler handler;
+  return perfect_router_find(&request, &handler);
+}
+
+long bench_format_response(long op) {
+  int index = op % CORPUS_SIZE;
+  int result = send_http_response(client, body_corpus[index], body_lengths[index]);
+  discard_output();
+  return result;
+}
+
+int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Sizes a round to run for at least MIN_ROUND_NS, then keeps the fastest
+// of ROUNDS rounds: interference only ever adds time, so the minimum is
+// what repeats from run to run.
+void run_benchmark(const char *name, long (*op)(long)) {
+  long ops = CORPUS_SIZE;
+  long total = 0;
+
+  while (1) {
+    uint64_t start = now_ns();
+    for (long i = 0; i < ops; i++)
+      total += op(i);
+    if (now_ns() - start >= MIN_ROUND_NS)
+      break;
+    ops *= 2;
+  }
+
+  double ns_per_op[ROUNDS];
+  long allocations_before = allocations;
+
+  for (int round = 0; round < ROUNDS; round++) {
+    uint64_t start = now_ns();
+    for (long i = 0; i < ops; i++)
+      total += op(i);
+    ns_per_op[round] = (double)(now_ns() - start) / ops;
+  }
+
+  long allocated = allocations - allocations_before;
+  sink = total;
+
+  qsort(ns_per_op, ROUNDS, sizeof(double), compare_doubles);
+  Result *result = &results[result_count++];
+  result->name = name;
+  result->ns_per_op = ns_per_op[0];
+  result->allocations_per_op = (double)allocated / ((double)ops * ROUNDS);
+}
+
+// returns the baseline entry for name, or NULL
+Result *find_result(Result *table, int count, const char *name) {
+  for (int i = 0; i < count; i++)
+    if (!strcmp(table[i].name, name))
+      return &table[i];
+  return NULL;
+}
+
+// lines of "name ns_per_op allocations_per_op"; '#' starts a comment.
+// Returns the number of entries, or -1 if the file can't be read.
+int load_baseline(const char *path, Result *table) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return -1;
+  }
+
+  int count = 0;
+  char line[256];
+  while (count < MAX_BENCHMARKS && fgets(line, sizeof(line), file)) {
+    char name[64];
+    Result *entry = &table[count];
+    if (line[0] == '#' ||
+        sscanf(line, "%63s %lf %lf", name, &entry->ns_per_op,
+               &entry->allocations_per_op) != 3)
+      continue;
+    entry->name = strdup(name);
+    count++;
+  }
+  fclose(file);
+  return count;
+}
+
+int save_baseline(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    return FAIL;
+  }
+
+  fprintf(file, "# bench/microbench baseline: name ns/op allocations/op\n"
+                "# regenerate with `make microbench-baseline`\n");
+  for (int i = 0; i < result_count; i++)
+    fprintf(file, "%s %.1f %.2f\n", results[i].name, results[i].ns_per_op,
+            results[i].allocations_per_op);
+  fclose(file);
+  return SUCCESS;
+}
+
+// prints the table; returns the number of regressions against baseline
+int report(Result *baseline, int baseline_count) {
+  int regressions = 0;
+
+  printf("%-18s %10s %10s", "benchmark", "ns/op", "allocs/op");
+  if (baseline)
+    printf(" %10s %8s", "base ns", "change");
+  printf("\n");
+
+  for (int i = 0; i < result_count; i++) {
+    Result *result = &results[i];
+    printf("%-18s %10.1f %10.2f", result->name, result->ns_per_op,
+           result->allocations_per_op);
+
+    Result *base = baseline ? find_result(baseline, baseline_count, result->name)
+                            : NULL;
+    if (base) {
+      double change = 100.0 * (result->ns_per_op - base->ns_per_op) /
+                      base->ns_per_op;
+      printf(" %10.1f %+7.1f%%", base->ns_per_op, change);
+
+      // allocations are exact, so any increase counts
+      if (change > threshold_percent ||
+          result->allocations_per_op > base->allocations_per_op + 0.005) {
+        printf("  REGRESSION");
+        regressions++;
+      }
+    } else if (baseline) {
+      printf(" %10s", "(new)");
+    }
+    printf("\n");
+  }
+  return regressions;
+}
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-c baseline] [-s baseline] [-t percent]\n"
+          "  -c  compare against this baseline; exit 1 on a regression\n"
+          "  -s  save the results as a new baseline\n"
+          "  -t  slowdown that counts as a regression (default 15%%)\n",
+          program);
+}
+
+int main(int argc, char *argv[]) {
+  int option;
+  while ((option = getopt(argc, argv, "c:s:t:")) != -1) {
+    switch (option) {
+    case 'c':
+      baseline_to_compare = optarg;
+      break;
+    case 's':
+      baseline_to_save = optarg;
+      break;
+    case 't':
+      threshold_percent = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  Result baseline[MAX_BENCHMARKS];
+  int baseline_count = 0;
+  if (baseline_to_compare) {
+    baseline_count = load_baseline(baseline_to_compare, baseline);
+    if (baseline_count < 0)
+      return 2;
+  }
+
+  ticker_start();
+  http_init();
+  build_corpora();
+
+  // buffered output: responses are built exactly as for a socket, minus
+  // the send
+  struct sockaddr_in nowhere = {0};
+  client_table_init(1);
+  client = client_new(-1, &nowhere);
+  client->buffer_output = 1;
+
+  run_benchmark("parse_request", bench_parse_request);
+  run_benchmark("dispatch", bench_dispatch);
+  run_benchmark("math_request", bench_math_request);
+  run_benchmark("route_lookup", bench_route_lookup);
+  run_benchmark("perfect_lookup", bench_perfect_lookup);
+  run_benchmark("format_response", bench_format_response);
+
+  int regressions =
+      report(baseline_to_compare ? baseline : NULL, baseline_count);
+
+  if (baseline_to_save && save_baseline(baseline_to_save) == FAIL)
+    return 2;
+
+  return regressions ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Loopback benchmark: starts the optimized server, runs a fixed set of
+# load-generator scenarios against /plus/ and /static/, then stops it
+# (the server prints its own latency summary on the way out).
+#
+#   BENCH_MODE=epoll BENCH_SERVER_ARGS="-t 4" make bench
+#
+# BENCH_DURATION (seconds per scenario), BENCH_CONNECTIONS and BENCH_RATE
+# (open-loop total req/s) tune the load side; BENCH_SERVER_LOG keeps the
+# server's stderr.
+
+MODE=${BENCH_MODE:-threads}
+DURATION=${BENCH_DURATION:-5}
+CONNECTIONS=${BENCH_CONNECTIONS:-32}
+RATE=${BENCH_RATE:-10000}
+LOADGEN=./bench/loadgen
+
+# the server logs every close to stderr, even with -q
+./main-bench -q -m "$MODE" $BENCH_SERVER_ARGS 2>"${BENCH_SERVER_LOG:-/dev/null}" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT INT TERM
+
+# wait for the listener
+sleep 0.5
+if ! kill -0 $SERVER 2>/dev/null; then
+  echo "server did not start" >&2
+  exit 1
+fi
+
+echo "server: -m $MODE $BENCH_SERVER_ARGS"
+echo
+
+$LOADGEN -c "$CONNECTIONS" -d "$DURATION" -u /plus/1/2
+$LOADGEN -c "$CONNECTIONS" -d "$DURATION" -u /static/foo.txt
+$LOADGEN -c "$CONNECTIONS" -d "$DURATION" -n -u /plus/1/2
+$LOADGEN -c "$CONNECTIONS" -d "$DURATION" -n -u /static/foo.txt
+$LOADGEN -c "$CONNECTIONS" -d "$DURATION" -r "$RATE" -u /plus/1/2
+$LOADGEN -c "$CONNECTIONS" -d "$DURATION" -r "$RATE" -u /static/foo.txt
+
+# SIGTERM makes the server print its per-route latency summary
+kill $SERVER
+wait $SERVER 2>/dev/null
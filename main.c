@@ -1,77 +1,399 @@
 // seeded from https://www.binarytides.com/socket-programming-c-linux-tutorial/
 
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "AccessLog.h"
 #include "Client.h"
+#include "EventLoop.h"
+#include "Handoff.h"
+#include "Http.h"
+#include "Latency.h"
+#include "Metrics.h"
+#include "Server.h"
+#include "StaticCache.h"
+#include "Ticker.h"
+#include "Uring.h"
+#include "WorkerPool.h"
 
 int debug = 1;
+int io_mode = IO_MODE_THREADS;
+int loop_thread_count = 0; // 0 = one per online CPU
+int worker_count = 128;
+int listener_count = 0; // 0 = one plain listening socket, not sharded
+int listen_backlog = PENDING_CONNECTIONS_QUEUE_LENGTH;
+long static_cache_megabytes = 64;
+const char *access_log_path = NULL;
+int max_connections = 65536;
+
+// -m threads: every connection's deadline, shared by the workers; the
+// timeout thread closes expired sockets under the lock, so a worker
+// freeing its client (which cancels, taking the lock) can't race it
+pthread_mutex_t blocking_timeouts_lock = PTHREAD_MUTEX_INITIALIZER;
+Timer_wheel blocking_timeouts;
+
+// every socket we accept on
+int listen_sockets[MAX_LISTENERS];
+int listen_socket_count = 0;
+
+// -m threads: who to interrupt out of accept() when draining
+pthread_t accept_threads[MAX_LISTENERS];
+int accept_thread_running[MAX_LISTENERS];
+
+int draining = 0;
+int accepting_loops = 0;
+
+// what SIGUSR2 runs again
+char **program_argv;
 
 #define LISTEN_PORT 8888
-#define PENDING_CONNECTIONS_QUEUE_LENGTH 3
-#define MAX_MESSAGE_LENGTH (10 * 1024 * 1024)
-#define MAX_GENERATED_LENGTH 1024
-#define MAX_FILESIZE 30 * 1024 * 1024
-
-// Thread payload
-typedef struct {
-  Client *client;
-} Thread_data;
-
-// Takes a Thread_data*.
-void *single_client_handler_threadfunc(void *);
+#define LATENCY_SUMMARY_SIZE 2048
 
 // forward decls
 //! All return FAIL (0). Anything else is successey
-int establish_listening_socket(int port_to_listen);
+int establish_listening_socket(int port_to_listen, int reuse_port);
 int handle_new_client_wrapper(Client *cl);
 int handle_new_client_guts(Client *cl);
 int accept_a_client(int listen_socket, Client **new_client_ptr);
+int accept_loop(int index);
+void *accept_loop_threadfunc(void *);
 int close_down_listening(int listening_socket);
-int read_http_request(int socket_fd, char **request_ptr);
-int respond_to_http_request(Client *cl, char *request);
-int send_http_response(Client *cl, char *body);
-int handle_math_request(Client *cl, char *request);
-int handle_static_request(Client *cl, char *request);
+int start_shutdown_thread(void);
+void *shutdown_threadfunc(void *);
+int start_timeout_thread(void);
+void *timeout_threadfunc(void *);
+void drain_connections(void);
+
+void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-m threads|epoll|uring] [-w workers] [-t loop_threads]\n"
+          "          [-l listeners] [-b backlog] [-c cache_mb]\n"
+          "          [-a access_log] [-n max_connections] [-q]\n"
+          "  -m  how to service connections (default threads)\n"
+          "  -w  worker threads for -m threads (default 128); each keeps\n"
+          "      one connection until it closes\n"
+          "  -t  loop threads for -m epoll/uring (default: one per CPU)\n"
+          "  -l  shard accepting over this many SO_REUSEPORT sockets, each\n"
+          "      with its own accept loop pinned to a CPU (for epoll/uring\n"
+          "      these are the loop threads, and -t is ignored)\n"
+          "  -b  listen backlog per socket (default %d)\n"
+          "  -c  memory for mmap'd /static/ files, in MB (default 64, 0 = off)\n"
+          "  -a  append a JSON line per request to this file\n"
+          "      (e.g. requests.jsonl)\n"
+          "  -n  most connections open at once (default 65536); more are\n"
+          "      accepted and closed straight away\n"
+          "  -q  quiet: turn off debug output\n"
+          "SIGUSR2 starts this binary again, hands it the listening\n"
+          "sockets, and exits once the connections still open are done.\n",
+          program, PENDING_CONNECTIONS_QUEUE_LENGTH);
+}
 
-// this returns FAIL (system error - close connection), SUCCESS,
-// or NONEXISTENT_FILE
-int read_file_contents(const char *file_path, char *buf, int buffer_length);
+// returns FAIL if the command line makes no sense
+int parse_options(int argc, char *argv[]) {
+  int opt;
+  while ((opt = getopt(argc, argv, "m:w:t:l:b:c:a:n:q")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (!strcmp(optarg, "threads"))
+        io_mode = IO_MODE_THREADS;
+      else if (!strcmp(optarg, "epoll"))
+        io_mode = IO_MODE_EPOLL;
+      else if (!strcmp(optarg, "uring"))
+        io_mode = IO_MODE_URING;
+      else
+        return FAIL;
+      break;
+    case 'w':
+      worker_count = atoi(optarg);
+      if (worker_count < 1)
+        return FAIL;
+      break;
+    case 't':
+      loop_thread_count = atoi(optarg);
+      if (loop_thread_count < 1)
+        return FAIL;
+      break;
+    case 'l':
+      listener_count = atoi(optarg);
+      if (listener_count < 1 || listener_count > MAX_LISTENERS)
+        return FAIL;
+      break;
+    case 'b':
+      listen_backlog = atoi(optarg);
+      if (listen_backlog < 1)
+        return FAIL;
+      break;
+    case 'c':
+      static_cache_megabytes = atol(optarg);
+      if (static_cache_megabytes < 0)
+        return FAIL;
+      break;
+    case 'a':
+      access_log_path = optarg;
+      break;
+    case 'n':
+      max_connections = atoi(optarg);
+      if (max_connections < 1)
+        return FAIL;
+      break;
+    case 'q':
+      debug = 0;
+      break;
+    default:
+      return FAIL;
+    }
+  }
+
+  if (loop_thread_count == 0) {
+    loop_thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (loop_thread_count < 1)
+      loop_thread_count = 1;
+  }
+
+  // sharded: one event loop per listening socket
+  if (listener_count > 0)
+    loop_thread_count = listener_count;
+
+  return SUCCESS;
+}
+
+// With sharded listeners every accept (or event) loop stays on one CPU,
+// so a connection is accepted and served where the kernel steered it.
+void pin_thread_to_cpu(int loop_index) {
+  if (listener_count == 0)
+    return;
+
+  int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 1)
+    return;
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(loop_index % cpus, &cpu_set);
+
+  int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (result != 0 && debug)
+    fprintf(stderr, "could not pin loop %d to a cpu (%d)\n", loop_index,
+            result);
+}
+
+// only there so SIGUSR1 interrupts a blocking accept()
+void wake_up(int signal_number) {}
 
 int main(int argc, char *argv[]) {
-  int our_socket_fd = establish_listening_socket(LISTEN_PORT);
-  if (our_socket_fd == FAIL) {
+  program_argv = argv;
+  if (parse_options(argc, argv) == FAIL) {
+    usage(argv[0]);
+    exit(1);
+  }
+
+  if (http_init() == FAIL || client_table_init(max_connections) == FAIL)
+    exit(1);
+
+  // a client hanging up mid-response shows up as a write error instead
+  signal(SIGPIPE, SIG_IGN);
+
+  // no SA_RESTART, so the accept() fails with EINTR
+  struct sigaction wake = {.sa_handler = wake_up};
+  sigemptyset(&wake.sa_mask);
+  sigaction(SIGUSR1, &wake, NULL);
+
+  // before any other thread exists, so they all inherit the blocked
+  // SIGINT/SIGTERM/SIGUSR2 and only the shutdown thread sees them
+  if (start_shutdown_thread() == FAIL || ticker_start() == FAIL)
+    exit(1);
+
+  // without inotify we just serve every file from disk
+  static_cache_init(static_cache_megabytes * 1024 * 1024);
+
+  if (access_log_init(access_log_path) == FAIL) {
     puts("exiting.");
     exit(1);
   }
 
+  // an upgrade: the old server's sockets, still accepting into their queue
+  if (handoff_receive(listen_sockets, MAX_LISTENERS, &listen_socket_count) ==
+      FAIL) {
+    puts("exiting.");
+    exit(1);
+  }
+
+  int wanted_sockets = listener_count > 0 ? listener_count : 1;
+  if (listen_socket_count > 0)
+    wanted_sockets = listen_socket_count;
+
+  while (listen_socket_count < wanted_sockets) {
+    int fd = establish_listening_socket(LISTEN_PORT, listener_count > 0);
+    if (fd == FAIL) {
+      puts("exiting.");
+      exit(1);
+    }
+    listen_sockets[listen_socket_count++] = fd;
+  }
+
   if (debug)
     puts("Ready for incoming connections...");
 
+  accepting_loops =
+      io_mode == IO_MODE_THREADS ? listen_socket_count : loop_thread_count;
+
+  if (io_mode == IO_MODE_EPOLL)
+    event_loop_run(listen_sockets, listen_socket_count, loop_thread_count);
+  else if (io_mode == IO_MODE_URING)
+    uring_loop_run(listen_sockets, listen_socket_count, loop_thread_count);
+  else if (start_timeout_thread() != FAIL &&
+           worker_pool_start(worker_count, handle_new_client_guts) != FAIL) {
+    handoff_ready();
+    for (int i = 0; i < listen_socket_count; i++)
+      accept_thread_running[i] = 1;
+    if (listener_count == 0) {
+      accept_threads[0] = pthread_self();
+      accept_loop(0);
+    } else {
+      for (int i = 0; i < listen_socket_count; i++)
+        pthread_create(&accept_threads[i], NULL, accept_loop_threadfunc,
+                       (void *)(long)i);
+      for (int i = 0; i < listen_socket_count; i++)
+        pthread_join(accept_threads[i], NULL);
+    }
+  }
+
+  // the accepting stopped for an upgrade: the shutdown thread exits once
+  // the connections we still have are done
+  if (__atomic_load_n(&draining, __ATOMIC_ACQUIRE))
+    pthread_exit(NULL);
+
+  // getting here means serving stopped for good
+  for (int i = 0; i < listen_socket_count; i++)
+    close_down_listening(listen_sockets[i]);
+
+  return 1;
+}
+
+sigset_t shutdown_signals;
+
+int start_shutdown_thread(void) {
+  sigemptyset(&shutdown_signals);
+  sigaddset(&shutdown_signals, SIGINT);
+  sigaddset(&shutdown_signals, SIGTERM);
+  sigaddset(&shutdown_signals, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL);
+
+  pthread_t thread;
+  int result = pthread_create(&thread, NULL, shutdown_threadfunc, NULL);
+  if (result != 0) {
+    errno = result;
+    perror("pthread_create shutdown");
+    return FAIL;
+  }
+  pthread_detach(thread);
+  return SUCCESS;
+}
+
+// Waits for SIGINT/SIGTERM, then reports latencies, writes out the access
+// log and exits. SIGUSR2 first hands the listening sockets to a new copy
+// of the binary and lets our connections finish; if that copy doesn't
+// come up we just keep serving.
+void *shutdown_threadfunc(void *unused) {
+  while (1) {
+    int signal_number;
+    sigwait(&shutdown_signals, &signal_number);
+    if (signal_number != SIGUSR2)
+      break;
+
+    if (handoff_start(program_argv, listen_sockets, listen_socket_count) !=
+        FAIL) {
+      drain_connections();
+      break;
+    }
+    fputs("upgrade failed - still serving\n", stderr);
+  }
+
+  char summary[LATENCY_SUMMARY_SIZE];
+  if (latency_format(summary, sizeof(summary)) != FAIL)
+    printf("\nlatency by route, first byte in to last byte out:\n%s", summary);
+
+  access_log_flush();
+  exit(0);
+}
+
+// Stop accepting and wait for the connections still open to close,
+// for at most HANDOFF_DRAIN_LIMIT_NS.
+void drain_connections(void) {
+  __atomic_store_n(&draining, 1, __ATOMIC_RELEASE);
+
+  long give_up = ticker_monotonic_ns() + HANDOFF_DRAIN_LIMIT_NS;
+  struct timespec tick = {.tv_sec = 0, .tv_nsec = TIMER_WHEEL_TICK_NS};
+
+  while (ticker_monotonic_ns() < give_up) {
+    int accepting = __atomic_load_n(&accepting_loops, __ATOMIC_ACQUIRE);
+    if (accepting == 0 && metrics_open_connections() == 0) {
+      if (debug)
+        fputs("drained - exiting\n", stderr);
+      return;
+    }
+
+    // a blocking accept() only notices when a signal interrupts it; the
+    // loop may not have got there yet, so keep at it every tick
+    if (accepting > 0 && io_mode == IO_MODE_THREADS)
+      for (int i = 0; i < listen_socket_count; i++)
+        if (__atomic_load_n(&accept_thread_running[i], __ATOMIC_ACQUIRE))
+          pthread_kill(accept_threads[i], SIGUSR1);
+
+    nanosleep(&tick, NULL);
+  }
+
+  fprintf(stderr, "gave up draining with %ld connections open\n",
+          metrics_open_connections());
+}
+
+// index: which of listen_sockets
+int accept_loop(int index) {
   int keep_going = SUCCESS;
-  while (keep_going != FAIL) {
+  while (keep_going != FAIL && !__atomic_load_n(&draining, __ATOMIC_ACQUIRE)) {
     Client *new_client;
-    keep_going = accept_a_client(our_socket_fd, &new_client);
+    keep_going = accept_a_client(listen_sockets[index], &new_client);
 
-    if (keep_going != FAIL) {
+    if (keep_going != FAIL && new_client) {
       keep_going = handle_new_client_wrapper(new_client);
     }
   }
 
-  close_down_listening(our_socket_fd);
+  __atomic_store_n(&accept_thread_running[index], 0, __ATOMIC_RELEASE);
+  __atomic_sub_fetch(&accepting_loops, 1, __ATOMIC_RELEASE);
+  return FAIL;
+}
 
-  return 0;
+// one per sharded listener; the payload is the shard index
+void *accept_loop_threadfunc(void *payload_ptr) {
+  int index = (int)(long)payload_ptr;
+  pin_thread_to_cpu(index);
+  accept_loop(index);
+  return NULL;
 }
 
 // returns FAIL for failure, otherwise the fd to accept on
-int establish_listening_socket(int port_to_listen) {
-  int new_socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+// With reuse_port, several sockets can bind the same port and the kernel
+// spreads incoming connections across them.
+int establish_listening_socket(int port_to_listen, int reuse_port) {
+  // CLOEXEC: an upgraded binary gets the listening sockets passed over
+  // explicitly, and nothing else of ours
+  int new_socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (new_socket_fd == -1) {
     perror("Could not create socket");
     return FAIL;
@@ -79,6 +401,21 @@ int establish_listening_socket(int port_to_listen) {
   if (debug)
     fprintf(stderr, "accept socket fd is %d\n", new_socket_fd);
 
+  // restarting (e.g. between benchmark runs) must not trip over our own
+  // connections still in TIME_WAIT
+  int enable = 1;
+  if (setsockopt(new_socket_fd, SOL_SOCKET, SO_REUSEADDR, &enable,
+                 sizeof(enable)) < 0) {
+    perror("SO_REUSEADDR");
+    return FAIL;
+  }
+
+  if (reuse_port && setsockopt(new_socket_fd, SOL_SOCKET, SO_REUSEPORT,
+                               &enable, sizeof(enable)) < 0) {
+    perror("SO_REUSEPORT");
+    return FAIL;
+  }
+
   // We are going to listen on any address, the specified port
   struct sockaddr_in our_address;
   our_address.sin_family = AF_INET;
@@ -95,7 +432,7 @@ int establish_listening_socket(int port_to_listen) {
     puts("bind done");
 
   // establish that we are expecting incoming connections
-  int result = listen(new_socket_fd, PENDING_CONNECTIONS_QUEUE_LENGTH);
+  int result = listen(new_socket_fd, listen_backlog);
   if (result == -1) {
     perror("listen failed");
     return FAIL;
@@ -112,8 +449,13 @@ int accept_a_client(int listen_socket, Client **new_client_ptr) {
   if (debug)
     fprintf(stderr, "accepting a connection on fd %d\n", listen_socket);
 
-  int new_socket_fd =
-      accept(listen_socket, (struct sockaddr *)&client_addr, &sock_len);
+  int new_socket_fd = accept4(listen_socket, (struct sockaddr *)&client_addr,
+                              &sock_len, SOCK_CLOEXEC);
+  if (new_socket_fd < 0 && errno == EINTR) {
+    // woken up to stop accepting (or by a stray signal)
+    *new_client_ptr = NULL;
+    return SUCCESS;
+  }
   if (new_socket_fd < 0) {
     perror("accept failed");
     return FAIL;
@@ -121,7 +463,13 @@ int accept_a_client(int listen_socket, Client **new_client_ptr) {
   if (debug)
     fprintf(stderr, "Connection accepted. client fd is %d\n", new_socket_fd);
 
+  // a full table turns the connection away but keeps us accepting
   Client *cl = client_new(new_socket_fd, &client_addr);
+  if (!cl) {
+    if (debug)
+      fputs("connection table full - refusing a client\n", stderr);
+    close(new_socket_fd);
+  }
   *new_client_ptr = cl;
   return SUCCESS;
 }
@@ -135,224 +483,86 @@ int close_down_listening(int listening_socket) {
   return SUCCESS;
 }
 
-// returns FAIL for error, 1 for success
-//! Currently no "time to quit" handling
-int handle_new_client_wrapper(Client *cl) {
-  pthread_t client_handler_thread;
-
-  // we must allocate this because we (probably) return before thread executes
-  Thread_data *client_info = malloc(sizeof(Thread_data));
+int start_timeout_thread(void) {
+  timer_wheel_init(&blocking_timeouts, ticker_monotonic_ns(),
+                   &blocking_timeouts_lock);
 
-  client_info->client = cl;
-
-  int result =
-      pthread_create(&client_handler_thread,
-                     NULL, // Use default thread attributes
-                     single_client_handler_threadfunc, (void *)client_info);
-  if (result < 0) {
-    perror("pthread_create");
+  pthread_t thread;
+  int result = pthread_create(&thread, NULL, timeout_threadfunc, NULL);
+  if (result != 0) {
+    errno = result;
+    perror("pthread_create timeouts");
     return FAIL;
   }
-
-  if (debug)
-    fprintf(stderr, "Client handling thread is %lu\n", client_handler_thread);
-
+  pthread_detach(thread);
   return SUCCESS;
 }
 
-// Payload ptr will be freed in this handler
-void *single_client_handler_threadfunc(void *payload_ptr) {
-  Client *client = ((Thread_data *)payload_ptr)->client;
-  free(payload_ptr);
-
-  int client_index = client_id(client);
-  int result = handle_new_client_guts(client);
-
+// The worker is blocked reading; shutting the socket down wakes it with
+// end-of-stream and it closes the connection as usual.
+void blocking_timed_out(void *context, void *owner) {
+  Client *cl = (Client *)owner;
   if (debug)
-    fprintf(stderr, "handle_new_client_guts (id %d) returned %d\n", client_index,
-            result);
+    fprintf(stderr, "client %d timed out\n", client_id(cl));
+  metrics_count(METRIC_TIMEOUTS);
+  shutdown(client_socket(cl), SHUT_RDWR);
+}
 
-  return NULL;
+void *timeout_threadfunc(void *unused) {
+  struct timespec tick = {.tv_sec = 0, .tv_nsec = TIMER_WHEEL_TICK_NS};
+  while (1) {
+    nanosleep(&tick, NULL);
+    timer_wheel_expire(&blocking_timeouts, ticker_monotonic_ns(),
+                       blocking_timed_out, NULL);
+  }
+}
+
+// returns FAIL for error, 1 for success
+//! Currently no "time to quit" handling
+int handle_new_client_wrapper(Client *cl) {
+  // blocks while every worker is busy and the hand-off queue is full
+  return worker_pool_submit(cl);
 }
 
 int handle_new_client_guts(Client *client) {
+  client->batch_output = 1;
+  client->timeouts = &blocking_timeouts;
+
   while (1) {
     char *request;
-    int result = read_http_request(client_socket(client), &request);
+    int length;
+    int result = read_http_request(client, &request, &length);
 
     if (result == FAIL) {
-      fprintf(stderr, "client %d read failed - closing, returning",
+      fprintf(stderr, "client %d read failed - closing, returning\n",
               client_id(client));
       client_free(client);
       return FAIL;
     }
 
-    if (strlen(request) == 0) {
+    if (result == CONNECTION_CLOSED) {
       fprintf(stderr, "client %d closed socket - closing, returning\n",
               client_id(client));
       client_free(client);
-      free(request);
       return SUCCESS;
     }
 
-    if (debug)
-      fprintf(stderr,
-              "client sent request (%d bytes): \n"
-              "---\n"
-              "%s\n"
-              "---\n",
-              result, request);
-
     result = respond_to_http_request(client, request);
-    free(request);
+    client_finish_request(client);
+    // back to the pool between requests; the next read takes it right back
+    client_release_idle_input(client);
     if (result == FAIL) {
-      fprintf(stderr, "client %d response failed - closing, returning",
+      fprintf(stderr, "client %d response failed - closing, returning\n",
               client_id(client));
       client_free(client);
       return FAIL;
     }
-  }
-}
 
-// technically, we're just reading whatever they send us.
-//! Note, this fails for > MAX bytes
-// This is quasi-intentional because using blocking reads
-// and reading in chunks is more complicated than you
-// might think.
-int read_http_request(int socket_fd, char **request_ptr) {
-  *request_ptr = malloc(MAX_MESSAGE_LENGTH + 1);
-
-  int amount_read = read(socket_fd, *request_ptr, MAX_MESSAGE_LENGTH);
-
-  if (amount_read < 0) {
-    perror("read_http_request");
-    free(*request_ptr);
-    *request_ptr = NULL;
-    return FAIL;
-  }
-
-  (*request_ptr)[amount_read] = '\0';
-  *request_ptr = realloc(*request_ptr, amount_read + 1);
-
-  if (amount_read == 0) {
-    // client side closed connection
-    if (debug)
-      fputs("Client closed connection\n", stderr);
-
-    return SUCCESS;
-  }
-
-  if (debug)
-    fprintf(stderr, "Read %d bytes...\n", amount_read);
-
-  return SUCCESS;
-}
-
-int send_http_response(Client *cl, char *body) {
-  const char *canned_msg___fmt = "HTTP/1.1 200\n"
-                                 "Content-type: text/plain\n"
-                                 "Content-Length: %d\n"
-                                 "Connection: Keep-Alive\n"
-                                 "\n%s";
-
-  // 100 = space for formatted %d
-  int response_buffer_size = strlen(canned_msg___fmt) + 100 + strlen(body);
-  char *response = malloc(response_buffer_size);
-
-  snprintf(response, response_buffer_size, canned_msg___fmt, (int)strlen(body),
-           body);
-
-  int result = client_write(cl, response);
-  free(response);
-
-  return result;
-}
-
-int send_error_response(Client *cl) {
-  return send_http_response(cl, "Invalid request.\n"
-                                "\n"
-                                "Not found.\n");
-}
-
-int respond_to_http_request(Client *cl, char *request) {
-  if (!strncmp(request, "GET /plus/", 10))
-    return handle_math_request(cl, request);
-  if (!strncmp(request, "GET /static/", 10))
-    return handle_static_request(cl, request);
-
-  send_error_response(cl);
-  return SUCCESS;
-}
-
-int handle_math_request(Client *cl, char *request) {
-  int num1;
-  int num2;
-  int result = sscanf(request, "GET /plus/%d/%d ", &num1, &num2);
-
-  if (result < 2 || result == EOF) {
-    send_error_response(cl);
-    return SUCCESS;
-  }
-
-  char response_body[MAX_GENERATED_LENGTH];
-  snprintf(response_body, sizeof(response_body), "Sum of %d and %d is %d.\n",
-           num1, num2, num1 + num2);
-
-  return send_http_response(cl, response_body);
-}
-
-int handle_static_request(Client *cl, char *request) {
-  char file_path[MAX_GENERATED_LENGTH];
-  int result = sscanf(request, "GET /static/%s ", file_path);
-
-  if (result < 1 || result == EOF) {
-    send_error_response(cl);
-    return SUCCESS;
-  }
-
-  char *file_contents = malloc(MAX_FILESIZE);
-
-  result = read_file_contents(file_path, file_contents, MAX_FILESIZE);
-
-  if (result == FAIL)
-    return FAIL;
-  if (result == NONEXISTENT_FILE) {
-    return send_http_response(cl, "Nonexistent resource\n");
-  }
-  return send_http_response(cl, file_contents);
-}
-
-int file_size(FILE *fp) {
-  // https://stackoverflow.com/questions/238603/how-can-i-get-a-files-size-in-c
-
-  int current_position = ftell(fp);
-
-  fseek(fp, 0L, SEEK_END);
-
-  int file_sz = ftell(fp);
-
-  fseek(fp, current_position, SEEK_SET);
-
-  return file_sz;
-}
-
-// this returns FAIL (system error - close connection), SUCCESS,
-// or NONEXISTENT_FILE
-int read_file_contents(const char *file_path, char *buf, int buffer_length) {
-  FILE *fp = fopen(file_path, "r");
-
-  if (!fp) {
-    return NONEXISTENT_FILE;
-  }
-
-  int result = fread(buf, sizeof(char), buffer_length, fp);
-
-  fclose(fp);
-
-  if (result == 0) {
-    fprintf(stderr, "unable to read file '%s'.\n", file_path);
-    return FAIL;
+    // draining for an upgrade: that was its Connection: close response
+    if (client->close_after_response) {
+      result = client_flush_output(client);
+      client_free(client);
+      return result;
+    }
   }
-
-  return SUCCESS;
 }
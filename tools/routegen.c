@@ -0,0 +1,216 @@
+// Turns a route list (see routes.list) into PerfectRoutes.h: a minimal
+// perfect hash over the routes' keys, compiled into the server so a
+// lookup is two hashes and one comparison, with nothing built at runtime.
+//
+// Uses hash-and-displace: keys are spread over buckets by one hash, then
+// each bucket gets the seed that sends all of its keys to free slots.
+//
+//   tools/routegen routes.list > PerfectRoutes.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../PerfectHash.h"
+
+#define MAX_ROUTES 64
+#define MAX_FIELD 256
+#define MAX_SEED_TRIES (1 << 24)
+
+typedef struct {
+  char method[MAX_FIELD];
+  char pattern[MAX_FIELD];
+  char handler[MAX_FIELD];
+  char name[MAX_FIELD];
+  int literal_length;
+  int key_length;
+  int params;
+  int wildcard;
+  int bucket;
+  int slot;
+} Route;
+
+Route routes[MAX_ROUTES];
+int route_count = 0;
+
+int fail(const char *list, int line, const char *why) {
+  fprintf(stderr, "%s:%d: %s\n", list, line, why);
+  return 0;
+}
+
+// Splits a pattern into its literal prefix and a tail of :name segments,
+// optionally ending in *name - all the generated lookup can match.
+int parse_pattern(Route *route, const char *list, int line) {
+  const char *pattern = route->pattern;
+  if (pattern[0] != '/')
+    return fail(list, line, "pattern must start with '/'");
+
+  route->literal_length = strcspn(pattern, ":*");
+  route->key_length = perfect_key_length(pattern, route->literal_length);
+
+  const char *tail = pattern + route->literal_length;
+  if (*tail && !(route->key_length > 1 && pattern[route->key_length - 1] == '/'))
+    return fail(list, line,
+                "parameters can only follow a literal /first/ segment");
+
+  while (*tail) {
+    if (route->wildcard)
+      return fail(list, line, "nothing may follow *name");
+
+    route->wildcard = *tail == '*';
+    if (!route->wildcard)
+      route->params++;
+
+    tail += strcspn(tail, "/");
+    if (*tail == '/') {
+      tail++;
+      if (*tail != ':' && *tail != '*')
+        return fail(list, line, "no literal text after a parameter");
+    }
+  }
+  return 1;
+}
+
+int read_routes(const char *list) {
+  FILE *file = fopen(list, "r");
+  if (!file) {
+    perror(list);
+    return 0;
+  }
+
+  char text[4 * MAX_FIELD];
+  int line = 0;
+  while (fgets(text, sizeof(text), file)) {
+    line++;
+    if (text[strspn(text, " \t")] == '#' || text[strspn(text, " \t\r\n")] == 0)
+      continue;
+
+    if (route_count == MAX_ROUTES)
+      return fail(list, line, "too many routes");
+
+    Route *route = &routes[route_count];
+    memset(route, 0, sizeof(Route));
+    if (sscanf(text, "%255s %255s %255s %255s", route->method, route->pattern,
+               route->handler, route->name) != 4)
+      return fail(list, line, "expected: method pattern handler name");
+    if (!parse_pattern(route, list, line))
+      return 0;
+
+    for (int i = 0; i < route_count; i++)
+      if (!strcmp(routes[i].method, route->method) &&
+          routes[i].key_length == route->key_length &&
+          !strncmp(routes[i].pattern, route->pattern, route->key_length))
+        return fail(list, line, "two routes share a key (method and first "
+                                "path segment)");
+    route_count++;
+  }
+
+  fclose(file);
+  if (route_count == 0)
+    return fail(list, line, "no routes");
+  return 1;
+}
+
+unsigned hash_route(Route *route, unsigned seed) {
+  return perfect_hash_mix(perfect_hash_key(route->method, strlen(route->method),
+                                           route->pattern, route->key_length),
+                          seed);
+}
+
+// finds a seed per bucket, biggest buckets first; fills in every slot
+int place_routes(int bucket_count, unsigned *seeds) {
+  int bucket_sizes[MAX_ROUTES] = {0};
+  for (int i = 0; i < route_count; i++) {
+    routes[i].bucket = hash_route(&routes[i], 0) % bucket_count;
+    bucket_sizes[routes[i].bucket]++;
+  }
+
+  int taken[MAX_ROUTES] = {0};
+  for (int size = route_count; size > 0; size--) {
+    for (int bucket = 0; bucket < bucket_count; bucket++) {
+      if (bucket_sizes[bucket] != size)
+        continue;
+
+      unsigned seed;
+      for (seed = 1; seed < MAX_SEED_TRIES; seed++) {
+        int slots[MAX_ROUTES];
+        int placed = 0;
+        int ok = 1;
+
+        for (int i = 0; i < route_count && ok; i++) {
+          if (routes[i].bucket != bucket)
+            continue;
+          int slot = hash_route(&routes[i], seed) % route_count;
+          if (taken[slot])
+            ok = 0;
+          for (int j = 0; j < placed && ok; j++)
+            if (slots[j] == slot)
+              ok = 0;
+          slots[placed++] = slot;
+        }
+        if (ok)
+          break;
+      }
+      if (seed == MAX_SEED_TRIES)
+        return 0;
+
+      seeds[bucket] = seed;
+      for (int i = 0; i < route_count; i++)
+        if (routes[i].bucket == bucket) {
+          routes[i].slot = hash_route(&routes[i], seed) % route_count;
+          taken[routes[i].slot] = 1;
+        }
+    }
+  }
+  return 1;
+}
+
+void write_header(const char *list, int bucket_count, unsigned *seeds) {
+  printf("// Generated by tools/routegen from %s - do not edit.\n\n", list);
+  printf("#define PERFECT_ROUTE_COUNT %d\n", route_count);
+  printf("#define PERFECT_ROUTE_BUCKETS %d\n\n", bucket_count);
+
+  printf("static const unsigned perfect_route_seeds[PERFECT_ROUTE_BUCKETS] = {");
+  for (int i = 0; i < bucket_count; i++)
+    printf("%s%u", i ? ", " : "", seeds[i]);
+  printf("};\n\n");
+
+  printf("// by hash slot\n");
+  printf("static Perfect_route perfect_routes[PERFECT_ROUTE_COUNT] = {\n");
+  for (int slot = 0; slot < route_count; slot++)
+    for (int i = 0; i < route_count; i++) {
+      Route *r = &routes[i];
+      if (r->slot != slot)
+        continue;
+      printf("    {\"%s\", %d, \"%s\", %d, %d, %d, %d, %s, \"%s\", 0},\n",
+             r->method, (int)strlen(r->method), r->pattern, r->literal_length,
+             r->key_length, r->params, r->wildcard, r->handler, r->name);
+    }
+  printf("};\n\n");
+
+  printf("// slots in list order, which is the order routes are registered\n");
+  printf("static const int perfect_route_order[PERFECT_ROUTE_COUNT] = {");
+  for (int i = 0; i < route_count; i++)
+    printf("%s%d", i ? ", " : "", routes[i].slot);
+  printf("};\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s routes.list > PerfectRoutes.h\n", argv[0]);
+    return 2;
+  }
+
+  if (!read_routes(argv[1]))
+    return 1;
+
+  int bucket_count = (route_count + 1) / 2;
+  unsigned seeds[MAX_ROUTES] = {0};
+  if (!place_routes(bucket_count, seeds)) {
+    fprintf(stderr, "%s: no perfect hash found\n", argv[1]);
+    return 1;
+  }
+
+  write_header(argv[1], bucket_count, seeds);
+  return 0;
+}